@@ -0,0 +1,408 @@
+#include "ApngWriter.h"
+#include "Bytes.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+
+using namespace std;
+
+// Image data is split over chunks of at most this many bytes, well under the 2 GB a chunk can hold
+constexpr size_t MaxChunkBytes = 1 << 30;
+
+// Whether a pixel of transparent black comes out of a file of this colour type as it went in
+static bool StoresTransparentBlack(const LodePNGColorMode& mode)
+{
+    if (mode.colortype == LCT_RGBA || mode.colortype == LCT_GREY_ALPHA)
+        return true;
+    if (mode.colortype == LCT_PALETTE)
+    {
+        for (size_t k = 0; k < mode.palettesize; k++)
+        {
+            if (memcmp(&mode.palette[k * 4], "\0\0\0\0", 4) == 0)
+                return true;
+        }
+        return false;
+    }
+    if (mode.colortype == LCT_GREY)
+        return mode.key_defined && mode.key_r == 0;
+    return mode.key_defined && mode.key_r == 0 && mode.key_g == 0 && mode.key_b == 0;
+}
+
+// Joins up the data of every IDAT chunk of an encoded PNG
+static void ImageData(const vector<uint8>& png, vector<uint8>& data)
+{
+    data.clear();
+    const uint8* end = png.data() + png.size();
+    for (const uint8* chunk = png.data() + 8; chunk + 12 <= end; chunk = lodepng_chunk_next_const(chunk, end))
+    {
+        if (lodepng_chunk_type_equals(chunk, "IDAT"))
+            data.insert(data.end(), lodepng_chunk_data_const(chunk), lodepng_chunk_data_const(chunk) + lodepng_chunk_length(chunk));
+    }
+}
+
+ApngWriter::ApngWriter()
+{
+    lodepng_color_mode_init(&raw);
+    lodepng_color_mode_init(&colourType);
+}
+
+ApngWriter::~ApngWriter()
+{
+    lodepng_color_mode_cleanup(&raw);
+    lodepng_color_mode_cleanup(&colourType);
+}
+
+bool ApngWriter::Open(const filesystem::path& newPath, int32 newWidth, int32 newHeight, int32 newFrameCount, int32 newFrameRate, int32 newLoops, const PngEncoder& newEncoder, const vector<uint32>& colours, string& error)
+{
+    lodepng_color_mode_cleanup(&raw);
+    lodepng_color_mode_cleanup(&colourType);
+    raw = lodepng_color_mode_make(LCT_RGBA, 8);
+    colourType = lodepng_color_mode_make(LCT_RGBA, 8);
+    if (!colours.empty())
+    {
+        if (uint32 lodepngError = PngEncoder::ChooseColourType(colours, newWidth, newHeight, false, colourType))
+        {
+            error = format("Failed to choose the colour type: {}", lodepng_error_text(lodepngError));
+            return false;
+        }
+    }
+
+    pixelBytes = 4;
+    transparent.assign(4, 0);
+    canClear = true;
+    canBlend = StoresTransparentBlack(colourType);
+    return Start(newPath, newWidth, newHeight, newFrameCount, newFrameRate, newLoops, newEncoder, error);
+}
+
+bool ApngWriter::OpenIndexed(const filesystem::path& newPath, int32 newWidth, int32 newHeight, int32 newFrameCount, int32 newFrameRate, int32 newLoops, const PngEncoder& newEncoder, const vector<uint32>& palette, string& error)
+{
+    for (LodePNGColorMode* mode : { &raw, &colourType })
+    {
+        if (uint32 lodepngError = PngEncoder::MakePalette(palette, *mode))
+        {
+            error = format("Failed to make the palette: {}", lodepng_error_text(lodepngError));
+            return false;
+        }
+    }
+
+    pixelBytes = 1;
+    transparent.clear();
+    for (size_t k = 0; k < palette.size() && transparent.empty(); k++)
+    {
+        if (palette[k] == 0)
+            transparent.assign(1, (uint8)k);
+    }
+    canClear = !transparent.empty();
+    canBlend = canClear;
+    return Start(newPath, newWidth, newHeight, newFrameCount, newFrameRate, newLoops, newEncoder, error);
+}
+
+bool ApngWriter::Start(const filesystem::path& newPath, int32 newWidth, int32 newHeight, int32 newFrameCount, int32 newFrameRate, int32 newLoops, const PngEncoder& newEncoder, string& error)
+{
+    path = newPath;
+    width = newWidth;
+    height = newHeight;
+    frameCount = newFrameCount;
+    frameRate = newFrameRate;
+    loops = newLoops;
+    encoder = &newEncoder;
+    framesGiven = 0;
+    sequence = 0;
+    size = 0;
+
+    // Frame delays are a fraction of 16-bit numbers
+    if (frameRate <= 0 || frameRate > 65535)
+    {
+        error = format("A frame rate of {} can't be stored", frameRate);
+        return false;
+    }
+
+    file.open(path, ios::binary | ios::trunc);
+    if (!file)
+    {
+        error = format("Failed to open '{}'", path.string());
+        return false;
+    }
+    return true;
+}
+
+bool ApngWriter::WriteFrame(const vector<uint8>& pixels, string& error)
+{
+    if (framesGiven == frameCount)
+    {
+        error = format("The animation only has {} frames", frameCount);
+        return false;
+    }
+    if (pixels.size() != (size_t)width * height * pixelBytes)
+    {
+        error = "The frame isn't the size of the animation";
+        return false;
+    }
+
+    // The first frame is also the image shown where animated PNGs aren't supported, so it covers the whole canvas
+    if (framesGiven == 0)
+    {
+        Area area = { 0, 0, width, height };
+        vector<uint8> png;
+        if (uint32 lodepngError = encoder->Encode(pixels, width, height, raw, colourType, png))
+        {
+            error = format("Failed to encode the frame: {}", lodepng_error_text(lodepngError));
+            return false;
+        }
+        if (!WriteHeader(png, error))
+            return false;
+        pending = { area, Blend::Source, {} };
+        ImageData(png, pending.data);
+        previous = pixels;
+        previousArea = area;
+        framesGiven++;
+        return true;
+    }
+
+    // What is under this frame depends on how the one before is cleared away, so each way is tried with each blend
+    // Frames that replace what is under them are the same whatever it is, so they are only encoded once for each area
+    // Putting back what was under the first frame is the same as clearing it, so that is left out
+    Frame best;
+    Dispose bestDispose = Dispose::None;
+    vector<uint8> bestBase;
+    bool found = false;
+    vector<Frame> replacing;
+    for (Dispose dispose : { Dispose::None, Dispose::Background, Dispose::Previous })
+    {
+        if ((dispose == Dispose::Background && !canClear) || (dispose == Dispose::Previous && framesGiven < 2))
+            continue;
+
+        vector<uint8> base = dispose == Dispose::Previous ? previousBase : previous;
+        if (dispose == Dispose::Background)
+        {
+            for (int32 j = previousArea.y; j < previousArea.y + previousArea.height; j++)
+            {
+                for (int32 i = previousArea.x; i < previousArea.x + previousArea.width; i++)
+                    memcpy(&base[((size_t)width * j + i) * pixelBytes], transparent.data(), pixelBytes);
+            }
+        }
+
+        // A frame can't be empty, so one that changes nothing redraws the top left pixel
+        Area area = ChangedArea(pixels, base);
+        if (area.width == 0)
+            area = { 0, 0, 1, 1 };
+
+        for (Blend blend : { Blend::Source, Blend::Over })
+        {
+            Frame frame = { area, blend, {} };
+            vector<uint8> region = Crop(pixels, area);
+            if (blend == Blend::Over)
+            {
+                if (!canBlend || !MaskUnchanged(region, base, area))
+                    continue;
+                if (!Encode(region, area, frame.data, error))
+                    return false;
+            }
+            else
+            {
+                auto encoded = find_if(replacing.begin(), replacing.end(), [&](const Frame& other) { return other.area == area; });
+                if (encoded != replacing.end())
+                    frame.data = encoded->data;
+                else
+                {
+                    if (!Encode(region, area, frame.data, error))
+                        return false;
+                    replacing.push_back(frame);
+                }
+            }
+
+            if (!found || frame.data.size() < best.data.size())
+            {
+                best = move(frame);
+                bestDispose = dispose;
+                bestBase = base;
+                found = true;
+            }
+        }
+    }
+
+    if (!WritePending(bestDispose, error))
+        return false;
+    pending = move(best);
+    previousBase = move(bestBase);
+    previous = pixels;
+    previousArea = pending.area;
+    framesGiven++;
+    return true;
+}
+
+bool ApngWriter::Close(string& error)
+{
+    if (framesGiven != frameCount)
+    {
+        error = format("Only {} of {} frames were written", framesGiven, frameCount);
+        file.close();
+        return false;
+    }
+
+    if (!WritePending(Dispose::None, error))
+        return false;
+    chunk.assign(4, 0);
+    if (!WriteChunk("IEND", error))
+        return false;
+    file.close();
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", path.string());
+        return false;
+    }
+    return true;
+}
+
+// Smallest area holding every pixel that differs from base, empty if none do
+ApngWriter::Area ApngWriter::ChangedArea(const vector<uint8>& pixels, const vector<uint8>& base) const
+{
+    size_t rowBytes = (size_t)width * pixelBytes;
+    auto rowChanged = [&](int32 j) { return memcmp(&pixels[rowBytes * j], &base[rowBytes * j], rowBytes) != 0; };
+    auto pixelChanged = [&](int32 i, int32 j)
+    {
+        size_t offset = rowBytes * j + (size_t)i * pixelBytes;
+        return memcmp(&pixels[offset], &base[offset], pixelBytes) != 0;
+    };
+
+    int32 top = 0;
+    while (top < height && !rowChanged(top))
+        top++;
+    if (top == height)
+        return { 0, 0, 0, 0 };
+    int32 bottom = height - 1;
+    while (!rowChanged(bottom))
+        bottom--;
+
+    // Each row only has to be searched up to the edges already found
+    int32 left = width;
+    int32 right = -1;
+    for (int32 j = top; j <= bottom; j++)
+    {
+        for (int32 i = 0; i < left; i++)
+        {
+            if (pixelChanged(i, j))
+            {
+                left = i;
+                break;
+            }
+        }
+        for (int32 i = width - 1; i > right; i--)
+        {
+            if (pixelChanged(i, j))
+            {
+                right = i;
+                break;
+            }
+        }
+    }
+    return { left, top, right - left + 1, bottom - top + 1 };
+}
+
+vector<uint8> ApngWriter::Crop(const vector<uint8>& pixels, Area area) const
+{
+    size_t rowBytes = (size_t)area.width * pixelBytes;
+    vector<uint8> region(rowBytes * area.height);
+    for (int32 j = 0; j < area.height; j++)
+        memcpy(&region[rowBytes * j], &pixels[((size_t)width * (area.y + j) + area.x) * pixelBytes], rowBytes);
+    return region;
+}
+
+// Makes the pixels of a region that are the same as base transparent, so that drawn over base they leave it as it is
+// Fails if a pixel that changed isn't opaque, as it would be blended with base instead of replacing it
+bool ApngWriter::MaskUnchanged(vector<uint8>& region, const vector<uint8>& base, Area area) const
+{
+    for (int32 j = 0; j < area.height; j++)
+    {
+        for (int32 i = 0; i < area.width; i++)
+        {
+            uint8* pixel = &region[((size_t)area.width * j + i) * pixelBytes];
+            if (memcmp(pixel, &base[((size_t)width * (area.y + j) + area.x + i) * pixelBytes], pixelBytes) == 0)
+                memcpy(pixel, transparent.data(), pixelBytes);
+            else if ((pixelBytes == 4 ? pixel[3] : raw.palette[pixel[0] * 4 + 3]) != 255)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool ApngWriter::Encode(const vector<uint8>& region, Area area, vector<uint8>& data, string& error) const
+{
+    vector<uint8> png;
+    if (uint32 lodepngError = encoder->Encode(region, area.width, area.height, raw, colourType, png))
+    {
+        error = format("Failed to encode the frame: {}", lodepng_error_text(lodepngError));
+        return false;
+    }
+    ImageData(png, data);
+    return true;
+}
+
+// Copies every chunk of the first frame's PNG before its image data, then says how long the animation is
+bool ApngWriter::WriteHeader(const vector<uint8>& png, string& error)
+{
+    const uint8* end = png.data() + png.size();
+    const uint8* chunkStart = png.data() + 8;
+    while (chunkStart + 12 <= end && !lodepng_chunk_type_equals(chunkStart, "IDAT"))
+        chunkStart = lodepng_chunk_next_const(chunkStart, end);
+    file.write((const char*)png.data(), chunkStart - png.data());
+    size += chunkStart - png.data();
+
+    chunk.assign(4 + 8, 0);
+    WriteUint32(&chunk[4], frameCount);
+    WriteUint32(&chunk[8], loops);
+    return WriteChunk("acTL", error);
+}
+
+// Writes the frame held back, now that how it is cleared is known
+bool ApngWriter::WritePending(Dispose dispose, string& error)
+{
+    chunk.assign(4 + 26, 0);
+    WriteUint32(&chunk[4], sequence++);
+    WriteUint32(&chunk[8], pending.area.width);
+    WriteUint32(&chunk[12], pending.area.height);
+    WriteUint32(&chunk[16], pending.area.x);
+    WriteUint32(&chunk[20], pending.area.y);
+    WriteUint16(&chunk[24], 1);
+    WriteUint16(&chunk[26], frameRate);
+    chunk[28] = (uint8)dispose;
+    chunk[29] = (uint8)pending.blend;
+    if (!WriteChunk("fcTL", error))
+        return false;
+
+    // The first frame's data is the ordinary image data, the rest are numbered in with the frame controls
+    bool first = sequence == 1;
+    for (size_t offset = 0; offset < pending.data.size(); offset += MaxChunkBytes)
+    {
+        size_t length = min(MaxChunkBytes, pending.data.size() - offset);
+        size_t headerBytes = first ? 0 : 4;
+        chunk.assign(4 + headerBytes + length, 0);
+        if (!first)
+            WriteUint32(&chunk[4], sequence++);
+        memcpy(&chunk[4 + headerBytes], &pending.data[offset], length);
+        if (!WriteChunk(first ? "IDAT" : "fdAT", error))
+            return false;
+    }
+    return true;
+}
+
+// The chunk's data is in chunk from its 5th byte on, leaving room for the type in front as the CRC covers both
+bool ApngWriter::WriteChunk(const char* type, string& error)
+{
+    memcpy(chunk.data(), type, 4);
+
+    uint8 lengthBytes[4], crc[4];
+    WriteUint32(lengthBytes, (uint32)(chunk.size() - 4));
+    WriteUint32(crc, lodepng_crc32(chunk.data(), chunk.size()));
+    file.write((const char*)lengthBytes, 4);
+    file.write((const char*)chunk.data(), chunk.size());
+    file.write((const char*)crc, 4);
+    size += chunk.size() + 8;
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", path.string());
+        return false;
+    }
+    return true;
+}
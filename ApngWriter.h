@@ -0,0 +1,111 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <lodepng.h>
+
+#include "Types.h"
+#include "Encoder.h"
+
+// Writes every frame of an animation into one animated PNG, instead of a folder of PNG files
+// Each frame after the first is stored as only the rectangle that differs from what is already shown, and both how the
+// frame before it is cleared away and whether it replaces or is drawn over what is under it are chosen by encoding each
+// choice and keeping the smallest, so each frame is held back until the frame after it has been written
+// Frames are given whole, as 8-bit RGBA or as the indices of an indexed animation, and all have the colour type of the
+// file, which is chosen from the colours up front
+class ApngWriter
+{
+public:
+    ApngWriter();
+    ApngWriter(const ApngWriter&) = delete;
+    ApngWriter& operator=(const ApngWriter&) = delete;
+    ~ApngWriter();
+
+    // Starts an animation of frameCount width x height frames, shown frameRate times a second and played loops times,
+    // or for ever if 0, compressed with the encoder's settings, which must outlive the writer
+    // colours are every pixel the frames can have, as ColourMap::Colours gives them, or empty to write RGBA
+    bool Open(const std::filesystem::path& path, int32 width, int32 height, int32 frameCount, int32 frameRate, int32 loops, const PngEncoder& encoder, const std::vector<uint32>& colours, std::string& error);
+
+    // Starts an animation of 8-bit palette frames, which are then given as one byte indices into palette, as
+    // ColourMap::IndexRows gives them, instead of RGBA pixels
+    bool OpenIndexed(const std::filesystem::path& path, int32 width, int32 height, int32 frameCount, int32 frameRate, int32 loops, const PngEncoder& encoder, const std::vector<uint32>& palette, std::string& error);
+
+    // Encodes the next frame, and writes the one before it
+    bool WriteFrame(const std::vector<uint8>& pixels, std::string& error);
+
+    // Writes the last frame and ends the file, once every frame has been given
+    bool Close(std::string& error);
+
+    // Bytes written to the file so far
+    uint64 Size() const { return size; }
+
+private:
+    // How the area of a frame is cleared once it has been shown, before the next frame is drawn
+    enum class Dispose : uint8
+    {
+        None,        // Left as it is
+        Background,  // Cleared to transparent black
+        Previous     // Put back to how it was before the frame was drawn
+    };
+
+    // How a frame is drawn onto what is shown
+    enum class Blend : uint8
+    {
+        Source,  // Replaces it
+        Over     // Composited over it, so transparent pixels leave it as it is
+    };
+
+    // Part of the canvas covered by a frame
+    struct Area
+    {
+        int32 x, y, width, height;
+        bool operator==(const Area&) const = default;
+    };
+
+    // A frame whose data is encoded, waiting for the frame after it to choose how it is cleared
+    struct Frame
+    {
+        Area area = {};
+        Blend blend = Blend::Source;
+        std::vector<uint8> data;  // zlib stream of the image data
+    };
+
+    bool Start(const std::filesystem::path& path, int32 width, int32 height, int32 frameCount, int32 frameRate, int32 loops, const PngEncoder& encoder, std::string& error);
+    Area ChangedArea(const std::vector<uint8>& pixels, const std::vector<uint8>& base) const;
+    std::vector<uint8> Crop(const std::vector<uint8>& pixels, Area area) const;
+    bool MaskUnchanged(std::vector<uint8>& region, const std::vector<uint8>& base, Area area) const;
+    bool Encode(const std::vector<uint8>& region, Area area, std::vector<uint8>& data, std::string& error) const;
+    bool WriteHeader(const std::vector<uint8>& png, std::string& error);
+    bool WritePending(Dispose dispose, std::string& error);
+    bool WriteChunk(const char* type, std::string& error);
+
+    std::ofstream file;
+    std::filesystem::path path;
+    const PngEncoder* encoder = nullptr;
+    LodePNGColorMode raw = {};         // Of the frames given
+    LodePNGColorMode colourType = {};  // Of the file
+    size_t pixelBytes = 4;
+    int32 width = 0;
+    int32 height = 0;
+    int32 frameCount = 0;
+    int32 frameRate = 0;
+    int32 loops = 0;
+    int32 framesGiven = 0;
+    uint32 sequence = 0;  // Of the next fcTL or fdAT chunk
+    uint64 size = 0;
+
+    // Transparent black as a raw pixel, which a cleared area is made of and unchanged pixels are blended as
+    // Indexed frames only have it if the palette does, and it has to survive being stored in the colour type of the file
+    std::vector<uint8> transparent;
+    bool canClear = false;
+    bool canBlend = false;
+
+    std::vector<uint8> previous;      // Pixels of the frame before, all of which are shown once it has been drawn
+    std::vector<uint8> previousBase;  // What the frame before was drawn onto
+    Area previousArea = {};
+    Frame pending;
+    std::vector<uint8> chunk;  // Type and data of the chunk being written
+};
@@ -0,0 +1,369 @@
+#include "AsyncWriter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <format>
+#include <fstream>
+
+#ifdef JULIA_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+using namespace std;
+
+// Writer threads beyond this only queue more writes on the same disk
+constexpr int32 MaxWriterThreads = 4;
+
+// Longest write submitted at once, as the kernel writes at most a little under 2 GB per call
+constexpr size_t MaxWriteBytes = (size_t)1 << 30;
+
+AsyncWriter::AsyncWriter(WriteBackend backend, int32 queueDepth)
+    : backend(backend), queueDepth(max(queueDepth, 1))
+{
+#ifdef JULIA_IO_URING
+    if (backend == WriteBackend::IoUring && SetUpRing())
+        return;
+#endif
+    this->backend = WriteBackend::Threads;
+    StartWriterThreads();
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    string error;
+    Finish(error);
+    {
+        lock_guard lock(queueMutex);
+        stopping = true;
+    }
+    workReady.notify_all();
+    writers.clear();
+
+#ifdef JULIA_IO_URING
+    if (ring >= 0)
+        CloseRing();
+#endif
+}
+
+bool AsyncWriter::HasIoUring()
+{
+#ifdef JULIA_IO_URING
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool AsyncWriter::TakeError(string& error)
+{
+    lock_guard lock(queueMutex);
+    if (firstError.empty())
+        return true;
+    error = firstError;
+    firstError.clear();
+    return false;
+}
+
+int64 AsyncWriter::FilesWritten() const
+{
+    lock_guard lock(queueMutex);
+    return filesWritten;
+}
+
+bool AsyncWriter::Write(const filesystem::path& path, vector<uint8>&& contents, string& error)
+{
+#ifdef JULIA_IO_URING
+    if (backend == WriteBackend::IoUring)
+    {
+        // Finished writes are picked up first, and only waited for once every slot is in use
+        Reap(false);
+        while (slotsInUse == queueDepth && backend == WriteBackend::IoUring)
+            Reap(true);
+    }
+
+    // Waiting on the ring can fail, after which the rest of the files are written by threads instead
+    if (backend == WriteBackend::IoUring)
+    {
+        Job job = { path, move(contents) };
+        job.file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (job.file < 0)
+            Fail(job, strerror(errno));
+        else if (job.contents.empty())
+        {
+            int32 closed = close(job.file);
+            job.file = -1;
+            if (closed < 0)
+                Fail(job, strerror(errno));
+            else
+            {
+                lock_guard lock(queueMutex);
+                filesWritten++;
+            }
+        }
+        else
+        {
+            int32 slot = (int32)(find_if(slots.begin(), slots.end(), [](const Job& inUse) { return inUse.file < 0; }) - slots.begin());
+            slots[slot] = move(job);
+            slotsInUse++;
+            Submit(slot);
+        }
+        return TakeError(error);
+    }
+#endif
+
+    {
+        unique_lock lock(queueMutex);
+        slotFree.wait(lock, [&]() { return pending < queueDepth; });
+        queue.push_back({ path, move(contents) });
+        pending++;
+    }
+    workReady.notify_one();
+    return TakeError(error);
+}
+
+bool AsyncWriter::Finish(string& error)
+{
+#ifdef JULIA_IO_URING
+    while (slotsInUse > 0)
+        Reap(true);
+#endif
+    {
+        unique_lock lock(queueMutex);
+        slotFree.wait(lock, [&]() { return pending == 0; });
+    }
+    return TakeError(error);
+}
+
+void AsyncWriter::StartWriterThreads()
+{
+    for (int32 t = 0; t < min(queueDepth, MaxWriterThreads); t++)
+        writers.emplace_back(&AsyncWriter::WriterThread, this);
+}
+
+void AsyncWriter::WriterThread()
+{
+    unique_lock lock(queueMutex);
+    while (true)
+    {
+        workReady.wait(lock, [&]() { return stopping || !queue.empty(); });
+        if (queue.empty())
+            return;
+        Job job = move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+
+        ofstream file(job.path, ios::binary | ios::trunc);
+        file.write((const char*)job.contents.data(), job.contents.size());
+        file.close();
+        job.contents = {};
+
+        lock.lock();
+        if (!file && firstError.empty())
+            firstError = format("Failed to write to '{}'", job.path.string());
+        else if (file)
+            filesWritten++;
+        pending--;
+        slotFree.notify_all();
+    }
+}
+
+#ifdef JULIA_IO_URING
+#pragma region io_uring
+
+// liburing isn't a dependency, so the ring is set up and driven through the system calls and shared memory it wraps
+// The submission tail and completion head are only written here, and read by the kernel, the other ends the other way
+// round, so each is published or read with release and acquire ordering
+
+static int32 IoUringSetup(uint32 entryCount, io_uring_params& params)
+{
+    return (int32)syscall(__NR_io_uring_setup, entryCount, &params);
+}
+
+static int32 IoUringEnter(int32 ring, uint32 submitCount, uint32 waitCount, uint32 flags)
+{
+    return (int32)syscall(__NR_io_uring_enter, ring, submitCount, waitCount, flags, nullptr, 0);
+}
+
+template<typename T>
+static T* RingField(void* ring, uint32 offset)
+{
+    return (T*)((uint8*)ring + offset);
+}
+
+bool AsyncWriter::SetUpRing()
+{
+    io_uring_params params = {};
+    ring = IoUringSetup((uint32)queueDepth, params);
+    if (ring < 0)
+        return false;
+
+    // Plain writes came with reading and writing at the current position, and older kernels can't do them
+    if (!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(ring);
+        ring = -1;
+        return false;
+    }
+
+    // Newer kernels map both rings at once
+    submissionRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32);
+    completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        submissionRingSize = completionRingSize = max(submissionRingSize, completionRingSize);
+    entriesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+    submissionRing = mmap(nullptr, submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    completionRing = params.features & IORING_FEAT_SINGLE_MMAP
+        ? submissionRing
+        : mmap(nullptr, completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+    entries = mmap(nullptr, entriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    if (submissionRing == MAP_FAILED || completionRing == MAP_FAILED || entries == MAP_FAILED)
+    {
+        if (entries != MAP_FAILED)
+            munmap(entries, entriesSize);
+        if (completionRing != MAP_FAILED && completionRing != submissionRing)
+            munmap(completionRing, completionRingSize);
+        if (submissionRing != MAP_FAILED)
+            munmap(submissionRing, submissionRingSize);
+        close(ring);
+        ring = -1;
+        return false;
+    }
+
+    submissionTail = RingField<uint32>(submissionRing, params.sq_off.tail);
+    submissionMask = RingField<uint32>(submissionRing, params.sq_off.ring_mask);
+    submissionArray = RingField<uint32>(submissionRing, params.sq_off.array);
+    completionHead = RingField<uint32>(completionRing, params.cq_off.head);
+    completionTail = RingField<uint32>(completionRing, params.cq_off.tail);
+    completionMask = RingField<uint32>(completionRing, params.cq_off.ring_mask);
+    completions = RingField<io_uring_cqe>(completionRing, params.cq_off.cqes);
+    slots.resize(queueDepth);
+    return true;
+}
+
+void AsyncWriter::CloseRing()
+{
+    munmap(entries, entriesSize);
+    if (completionRing != submissionRing)
+        munmap(completionRing, completionRingSize);
+    munmap(submissionRing, submissionRingSize);
+    close(ring);
+    ring = -1;
+}
+
+// Writes as much of the rest of the slot's file as one write can take
+void AsyncWriter::Submit(int32 slot)
+{
+    Job& job = slots[slot];
+    uint32 tail = *submissionTail;
+    uint32 index = tail & *submissionMask;
+    io_uring_sqe& entry = ((io_uring_sqe*)entries)[index];
+    memset(&entry, 0, sizeof(entry));
+    entry.opcode = IORING_OP_WRITE;
+    entry.fd = job.file;
+    entry.addr = (uint64)(job.contents.data() + job.written);
+    entry.len = (uint32)min(job.contents.size() - job.written, MaxWriteBytes);
+    entry.off = job.written;
+    entry.user_data = (uint64)slot;
+    submissionArray[index] = index;
+    atomic_ref(*submissionTail).store(tail + 1, memory_order_release);
+
+    // Every slot has its entry, so the ring never fills up, and a submission only fails if the kernel is out of memory
+    int32 submitted;
+    while ((submitted = IoUringEnter(ring, 1, 0, 0)) < 0 && (errno == EINTR || errno == EAGAIN))
+        ;
+    if (submitted < 0)
+    {
+        // The kernel didn't take the entry, so it is taken back off the ring
+        int32 submitError = errno;
+        atomic_ref(*submissionTail).store(tail, memory_order_release);
+        Fail(job, strerror(submitError));
+        slotsInUse--;
+    }
+}
+
+void AsyncWriter::Fail(Job& job, const string& error)
+{
+    if (job.file >= 0)
+        close(job.file);
+    job.file = -1;
+    job.contents = {};
+    lock_guard lock(queueMutex);
+    if (firstError.empty())
+        firstError = format("Failed to write to '{}': {}", job.path.string(), error);
+}
+
+// Handles every write that has finished, waiting for one first if wait is set and none has
+void AsyncWriter::Reap(bool wait)
+{
+    while (true)
+    {
+        uint32 head = *completionHead;
+        if (head == atomic_ref(*completionTail).load(memory_order_acquire))
+        {
+            if (!wait)
+                return;
+            if (IoUringEnter(ring, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            {
+                // Nothing more will be heard back from the ring, so it is torn down, which cancels the writes still
+                // on it, and only then are their files given up on and their contents let go of
+                // The slots are never used again, as the rest of the files are written by threads instead
+                int32 waitError = errno;
+                CloseRing();
+                for (Job& inUse : slots)
+                {
+                    if (inUse.file >= 0)
+                        Fail(inUse, strerror(waitError));
+                }
+                slots.clear();
+                slotsInUse = 0;
+                backend = WriteBackend::Threads;
+                StartWriterThreads();
+                return;
+            }
+            continue;
+        }
+
+        io_uring_cqe completion = ((io_uring_cqe*)completions)[head & *completionMask];
+        atomic_ref(*completionHead).store(head + 1, memory_order_release);
+        wait = false;
+
+        // Writes can stop short, in which case the rest is submitted again
+        Job& job = slots[completion.user_data];
+        if (completion.res <= 0)
+        {
+            Fail(job, completion.res < 0 ? strerror(-completion.res) : "Nothing was written");
+            slotsInUse--;
+            continue;
+        }
+        job.written += completion.res;
+        if (job.written < job.contents.size())
+        {
+            Submit((int32)completion.user_data);
+            continue;
+        }
+
+        // Some file systems only report a failed write when the file is closed, quota and NFS errors among them
+        int32 closed = close(job.file);
+        job.file = -1;
+        slotsInUse--;
+        if (closed < 0)
+        {
+            Fail(job, strerror(errno));
+            continue;
+        }
+        job.contents = {};
+        lock_guard lock(queueMutex);
+        filesWritten++;
+    }
+}
+
+#pragma endregion
+#endif
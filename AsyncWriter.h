@@ -0,0 +1,99 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Types.h"
+
+// What writes the files queued on an AsyncWriter
+enum class WriteBackend
+{
+    IoUring,  // Submitted to the kernel through io_uring, without a writer thread, where it was found when building and
+              // the kernel allows it, otherwise Threads
+    Threads   // Written by a few writer threads
+};
+
+// Writes whole files in the background, so the next frame is computed while the last one is still reaching the disk
+// Up to queueDepth files are held and written at once, queueing another waits for one of them to finish, which keeps
+// the memory of the queue bounded when frames are computed faster than the disk takes them
+// Files are queued from one thread only
+class AsyncWriter
+{
+public:
+    AsyncWriter(WriteBackend backend, int32 queueDepth);
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    // Waits for every queued file
+    ~AsyncWriter();
+
+    static bool HasIoUring();
+
+    // Threads if io_uring was asked for but isn't there, or once waiting on the ring has failed
+    WriteBackend Backend() const { return backend; }
+
+    // Queues contents to be written to path, taking them over
+    // Returns false with the error of a file that failed since the last call, the file given is queued either way
+    bool Write(const std::filesystem::path& path, std::vector<uint8>&& contents, std::string& error);
+
+    // Waits for every queued file to be written, returns false with the error of a file that failed
+    bool Finish(std::string& error);
+
+    // Files written in full so far
+    int64 FilesWritten() const;
+
+private:
+    struct Job
+    {
+        std::filesystem::path path;
+        std::vector<uint8> contents;
+        int32 file = -1;   // io_uring only
+        size_t written = 0;
+    };
+
+    bool TakeError(std::string& error);
+    void StartWriterThreads();
+    void WriterThread();
+
+#ifdef JULIA_IO_URING
+    bool SetUpRing();
+    void CloseRing();
+    void Submit(int32 slot);
+    void Reap(bool wait);
+    void Fail(Job& job, const std::string& error);
+
+    int32 ring = -1;
+    void* submissionRing = nullptr;
+    size_t submissionRingSize = 0;
+    void* completionRing = nullptr;
+    size_t completionRingSize = 0;
+    void* entries = nullptr;
+    size_t entriesSize = 0;
+    uint32* submissionTail = nullptr;
+    uint32* submissionMask = nullptr;
+    uint32* submissionArray = nullptr;
+    uint32* completionHead = nullptr;
+    uint32* completionTail = nullptr;
+    uint32* completionMask = nullptr;
+    void* completions = nullptr;
+    std::vector<Job> slots;  // Files being written, a slot is free while its file is -1
+    int32 slotsInUse = 0;
+#endif
+
+    WriteBackend backend;
+    int32 queueDepth;
+    mutable std::mutex queueMutex;
+    std::condition_variable workReady;
+    std::condition_variable slotFree;
+    std::deque<Job> queue;
+    int32 pending = 0;  // Queued or being written by a thread
+    bool stopping = false;
+    std::vector<std::jthread> writers;
+    std::string firstError;
+    int64 filesWritten = 0;
+};
@@ -0,0 +1,454 @@
+// Benchmark suite for the rendering kernels
+// Every case renders the same fixed view several times and reports the fastest run, so results
+// are comparable between builds and between cases
+
+#include <iostream>
+#include <format>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <cstring>
+#include <filesystem>
+
+#include <lodepng.h>
+
+#include "Types.h"
+#include "Fractal.h"
+#include "Field.h"
+#include "Colour.h"
+#include "Parallel.h"
+#include "ParallelPng.h"
+#include "Encoder.h"
+#include "PngWriter.h"
+#include "QoiWriter.h"
+#include "Y4mWriter.h"
+
+#ifdef JULIA_PERF_EVENTS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+constexpr int32 BenchmarkRuns = 5;
+constexpr int32 BenchmarkIterations = 500;
+
+// Returns the fastest of BenchmarkRuns runs of body in milliseconds
+float64 Time(const function<void()>& body)
+{
+    float64 best = 0;
+    for (int32 run = 0; run < BenchmarkRuns; run++)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        body();
+        float64 elapsed = chrono::duration<float64, milli>(chrono::high_resolution_clock::now() - start).count();
+        best = run == 0 ? elapsed : min(best, elapsed);
+    }
+    return best;
+}
+
+// Returns the fastest of BenchmarkRuns renders of the viewport in milliseconds
+float64 TimeRows(const Viewport& viewport, const function<void(int32, float64*)>& renderRow)
+{
+    vector<float64> row(viewport.width);
+    return Time([&]()
+    {
+        for (int32 j = 0; j < viewport.height; j++)
+            renderRow(j, row.data());
+    });
+}
+
+void Report(const string& name, float64 milliseconds, float64 baseline = 0)
+{
+    if (baseline > 0)
+        cout << format("{:<32}{:>10.2f}ms{:>+10.1f}%", name, milliseconds, (milliseconds / baseline - 1) * 100) << endl;
+    else
+        cout << format("{:<32}{:>10.2f}ms", name, milliseconds) << endl;
+}
+
+// Cost of fusing orbit trap accumulation into the escape-time kernel, relative to the plain kernel
+void BenchmarkOrbitTraps(const Viewport& viewport)
+{
+    cout << "=== Orbit traps ===" << endl;
+
+    const pair<const char*, FractalType> fractals[] = { { "Julia", FractalType::Julia }, { "Mandelbrot", FractalType::Mandelbrot } };
+    const pair<const char*, OrbitTrapType> traps[] = { { "Point", OrbitTrapType::Point }, { "Line", OrbitTrapType::Line }, { "Cross", OrbitTrapType::Cross } };
+    FormulaParams params = { -0.8, 0.156, 2 };
+
+    for (auto& [fractalName, fractalType] : fractals)
+    {
+        OrbitTrap trap;
+        float64 plain = TimeRows(viewport, [&](int32 j, float64* out) { RenderRow(fractalType, viewport, j, params, trap, 4, BenchmarkIterations, out); });
+        Report(fractalName, plain);
+
+        for (auto& [trapName, trapType] : traps)
+        {
+            trap.type = trapType;
+            trap.directionX = trap.directionY = sqrt(0.5);
+            float64 trapped = TimeRows(viewport, [&](int32 j, float64* out) { RenderRow(fractalType, viewport, j, params, trap, 4, BenchmarkIterations, out); });
+            Report(format("{} + {} trap", fractalName, trapName), trapped, plain);
+        }
+    }
+    cout << endl;
+}
+
+// Julia field of the viewport, which every colouring and encoding case starts from
+IterationField RenderField(const Viewport& viewport)
+{
+    IterationField field;
+    field.maxIterations = BenchmarkIterations;
+    field.Allocate(viewport.width, viewport.height);
+    vector<float64> row(viewport.width);
+    for (int32 j = 0; j < viewport.height; j++)
+    {
+        RenderRow(FractalType::Julia, viewport, j, { -0.8, 0.156, 2 }, OrbitTrap(), 4, BenchmarkIterations, row.data());
+        for (int32 i = 0; i < viewport.width; i++)
+            field.Row(j)[i] = (float32)row[i];
+    }
+    return field;
+}
+
+// Cost of colouring a frame, relative to encoding it
+void BenchmarkColouring(const Viewport& viewport)
+{
+    cout << "=== Colouring ===" << endl;
+
+    IterationField field = RenderField(viewport);
+    vector<uint8> image((size_t)viewport.width * viewport.height * 4);
+    float64 build = Time([&]() { ColourMap colourMap{ ColourParams() }; });
+    ColourMap colourMap{ ColourParams() };
+    float64 colouring = Time([&]() { colourMap.ColourRows(field, 0, viewport.height, image.data()); });
+    ColourParams histogramParams;
+    histogramParams.mode = ColourMode::Histogram;
+    ColourMap histogramMap(histogramParams);
+    float64 histogram = Time([&]()
+    {
+        histogramMap.Equalize(field);
+        histogramMap.ColourRows(field, 0, viewport.height, image.data());
+    });
+    vector<uint8> wideImage((size_t)viewport.width * viewport.height * 8);
+    float64 wide = Time([&]() { colourMap.ColourRows16(field, 0, viewport.height, wideImage.data()); });
+    vector<float32> floatImage((size_t)viewport.width * viewport.height * 4);
+    float64 floats = Time([&]() { colourMap.ColourRowsFloat(field, 0, viewport.height, floatImage.data()); });
+    float64 encoding = Time([&]()
+    {
+        vector<uint8> png;
+        lodepng::encode(png, image, viewport.width, viewport.height);
+    });
+
+    Report("Palette build", build);
+    Report("Colouring", colouring);
+    Report("Histogram colouring", histogram, colouring);
+    Report("16-bit colouring", wide, colouring);
+    Report("Float colouring", floats, colouring);
+    Report("PNG encoding", encoding);
+    cout << endl;
+}
+
+// Time and size of encoding a frame with each deflate and preset, relative to lodepng's own
+// Uses a larger frame than the other cases, as deflate only spreads over threads in chunks of a few hundred KB
+void BenchmarkEncoding(const Viewport& viewport)
+{
+    Viewport large = viewport;
+    large.width *= 4;
+    large.height *= 4;
+    cout << format("=== PNG encoding ({}x{} pixels, {} threads) ===", large.width, large.height, ThreadCount()) << endl;
+
+    IterationField field = RenderField(large);
+    vector<uint8> image((size_t)large.width * large.height * 4);
+    ColourMap colourMap{ ColourParams() };
+    colourMap.ColourRows(field, 0, large.height, image.data());
+    vector<uint32> colours = colourMap.Colours(field.kind);
+
+    auto encodeWith = [&](const char* name, const function<void(vector<uint8>&)>& encodeFrame, float64 baselineTime, size_t baselineSize, size_t& size)
+    {
+        float64 elapsed = Time([&]()
+        {
+            vector<uint8> png;
+            encodeFrame(png);
+            size = png.size();
+        });
+        Report(name, elapsed, baselineTime);
+        if (baselineSize > 0)
+            cout << format("{:<32}{:>10} bytes{:>+7.1f}%", "", size, ((float64)size / baselineSize - 1) * 100) << endl;
+        else
+            cout << format("{:<32}{:>10} bytes", "", size) << endl;
+        return elapsed;
+    };
+    auto encode = [&](const char* name, const lodepng::State& state, float64 baselineTime, size_t baselineSize, size_t& size)
+    {
+        return encodeWith(name, [&](vector<uint8>& png)
+        {
+            lodepng::State encoder = state;
+            lodepng::encode(png, image, large.width, large.height, encoder);
+        }, baselineTime, baselineSize, size);
+    };
+
+    size_t serialSize, parallelSize;
+    lodepng::State serial;
+    float64 serialTime = encode("lodepng", serial, 0, 0, serialSize);
+    lodepng::State parallel;
+    parallel.encoder.zlibsettings.custom_deflate = ParallelDeflate;
+    encode("Parallel deflate", parallel, serialTime, serialSize, parallelSize);
+    parallel.encoder.custom_filter = ParallelFilter;
+    encode("Parallel filter + deflate", parallel, serialTime, serialSize, parallelSize);
+    parallel.encoder.zlibsettings.fast_lz77 = 1;
+    encode("Parallel + fast LZ77", parallel, serialTime, serialSize, parallelSize);
+    parallel.encoder.zlibsettings.max_chain_length = 16;
+    encode("Parallel + fast LZ77, chain 16", parallel, serialTime, serialSize, parallelSize);
+
+    // The presets of the Encoder config, as the renderer uses them
+    size_t presetSize, balancedSize = 0;
+    float64 balancedTime = 0;
+    for (auto [name, preset] : { pair{ "Store preset", EncoderPreset::Store }, pair{ "Fast preset", EncoderPreset::Fast }, pair{ "Balanced preset", EncoderPreset::Balanced }, pair{ "Max preset", EncoderPreset::Max } })
+    {
+        PngEncoder encoder(preset, DeflateBackend::Parallel);
+        float64 elapsed = encodeWith(name, [&](vector<uint8>& png) { encoder.Encode(image, large.width, large.height, {}, png); }, serialTime, serialSize, presetSize);
+        if (preset == EncoderPreset::Balanced)
+        {
+            balancedTime = elapsed;
+            balancedSize = presetSize;
+        }
+    }
+
+    // The renderer passes the colours of its palette, which saves lodepng a pass over the image to find them
+    // Compared to the Balanced preset from here on
+    PngEncoder balanced(EncoderPreset::Balanced, DeflateBackend::Parallel);
+    size_t coloursSize;
+    encodeWith("Balanced preset, known colours", [&](vector<uint8>& png) { balanced.Encode(image, large.width, large.height, colours, png); }, balancedTime, balancedSize, coloursSize);
+
+    // Indexed frames never have RGBA pixels, so colouring is timed along with encoding
+    vector<uint8> indices((size_t)large.width * large.height);
+    vector<uint32> indexedPalette = colourMap.IndexedPalette();
+    size_t colouredSize, indexedSize;
+    float64 colouredTime = encodeWith("Coloured + Balanced preset", [&](vector<uint8>& png)
+    {
+        colourMap.ColourRows(field, 0, large.height, image.data());
+        balanced.Encode(image, large.width, large.height, colours, png);
+    }, 0, 0, colouredSize);
+    for (bool dither : { false, true })
+    {
+        encodeWith(dither ? "Indexed + dithered + Balanced" : "Indexed + Balanced preset", [&](vector<uint8>& png)
+        {
+            colourMap.IndexRows(field, 0, large.height, dither, indices.data());
+            balanced.EncodeIndexed(indices, large.width, large.height, indexedPalette, png);
+        }, colouredTime, colouredSize, indexedSize);
+    }
+
+    // Without the colours, streaming writes RGBA, where lodepng can pick a smaller colour type with the whole image at hand
+    filesystem::path streamPath = filesystem::temp_directory_path() / "julia-benchmark.png";
+    size_t streamSize;
+    auto stream = [&](const char* name, const vector<uint32>& streamColours)
+    {
+        encodeWith(name, [&](vector<uint8>& png)
+        {
+            PngWriter writer;
+            string error;
+            int32 bandRows = PngWriter::BandRows(large.width);
+            writer.Open(streamPath, large.width, large.height, balanced, streamColours, error);
+            for (int32 firstRow = 0; firstRow < large.height; firstRow += bandRows)
+                writer.WriteRows(image.data() + (size_t)large.width * firstRow * 4, min(bandRows, large.height - firstRow), error);
+            writer.Close(error);
+            png.resize(writer.Size());
+        }, balancedTime, balancedSize, streamSize);
+    };
+    stream("Streamed, Balanced preset", {});
+    stream("Streamed, known colours", colours);
+
+    // QOI frames are written a band per thread at a time
+    filesystem::path qoiPath = filesystem::temp_directory_path() / "julia-benchmark.qoi";
+    size_t qoiSize;
+    encodeWith("QOI", [&](vector<uint8>& png)
+    {
+        QoiWriter writer;
+        string error;
+        int32 bandRows = PngWriter::CacheBandRows(large.width);
+        writer.Open(qoiPath, large.width, large.height, true, error);
+        ParallelFor((large.height + bandRows - 1) / bandRows, [&](int64 band, int32 thread)
+        {
+            int32 firstRow = (int32)band * bandRows;
+            string bandError;
+            writer.WriteBand(firstRow, image.data() + (size_t)large.width * firstRow * 4, min(bandRows, large.height - firstRow), bandError);
+        });
+        writer.Close(error);
+        png.resize(writer.Size());
+    }, balancedTime, balancedSize, qoiSize);
+
+    // y4m frames are only converted to 4:2:0, which halves the bytes without compressing anything
+    filesystem::path videoPath = filesystem::temp_directory_path() / "julia-benchmark.y4m";
+    size_t videoSize;
+    encodeWith("y4m", [&](vector<uint8>& png)
+    {
+        Y4mWriter writer;
+        string error;
+        int32 bandRows = max(2, PngWriter::CacheBandRows(large.width) & ~1);
+        writer.Open(videoPath.string(), large.width, large.height, 30, error);
+        ParallelFor((large.height + bandRows - 1) / bandRows, [&](int64 band, int32 thread)
+        {
+            int32 firstRow = (int32)band * bandRows;
+            writer.ConvertRows(firstRow, image.data() + (size_t)large.width * firstRow * 4, min(bandRows, large.height - firstRow));
+        });
+        writer.WriteFrame(error);
+        writer.Close(error);
+        png.resize(writer.Size());
+    }, balancedTime, balancedSize, videoSize);
+    filesystem::remove(streamPath);
+    filesystem::remove(qoiPath);
+    filesystem::remove(videoPath);
+
+    // Filtering reads two rows and writes one, so copying the image once is about the fastest it can go
+    LodePNGColorMode rgba = lodepng_color_mode_make(LCT_RGBA, 8);
+    vector<uint8> filtered(image.size() + large.height);
+    float64 copy = Time([&]() { memcpy(filtered.data(), image.data(), image.size()); });
+    float64 filter = Time([&]() { lodepng_filter_rows(filtered.data(), image.data(), large.width, 0, large.height, &rgba, &serial.encoder); });
+    float64 parallelFilter = Time([&]() { ParallelFilter(filtered.data(), image.data(), large.width, large.height, &rgba, &serial.encoder); });
+    Report("Copy", copy);
+    Report("Filtering", filter, copy);
+    Report("Parallel filtering", parallelFilter, copy);
+
+    // Every chunk written is checksummed, which is a whole extra pass over the compressed image
+    float64 crc = Time([&]() { lodepng_crc32(image.data(), image.size()); });
+    Report("CRC32", crc, copy);
+    cout << endl;
+}
+
+// Bytes read from memory while running body once, counted from the last-level cache misses of every thread
+// Returns false where the counters can't be read, as on most virtual machines
+bool MemoryTraffic(const function<void()>& body, uint64& bytes)
+{
+#ifdef JULIA_PERF_EVENTS
+    perf_event_attr attributes = {};
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+    attributes.disabled = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.inherit = 1;  // ParallelFor() starts its threads on each call, so they inherit the counter
+    int32 counter = (int32)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+    if (counter < 0)
+        return false;
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    body();
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    uint64 misses = 0;
+    bool counted = read(counter, &misses, sizeof(misses)) == sizeof(misses);
+    close(counter);
+    bytes = misses * 64;  // Each miss brings in a cache line
+    return counted;
+#else
+    return false;
+#endif
+}
+
+// Rendering, colouring and encoding a frame one step after the other, against doing all three a band at a time by the
+// same thread while the band is in cache, as streamed frames are
+// Fused bands are rendered into a field of their own for each thread, as Main does, so no frame-sized buffer is kept
+// Traffic is measured with the hardware counters where there are any, and otherwise only estimated from the bytes of
+// frame-sized buffers written and then read back by a later step, which at large sizes can't stay in cache between steps
+void BenchmarkPipeline(const Viewport& viewport)
+{
+    Viewport large = viewport;
+    large.width *= 4;
+    large.height *= 4;
+    cout << format("=== Frame pipeline ({}x{} pixels, {} threads) ===", large.width, large.height, ThreadCount()) << endl;
+
+    ColourMap colourMap{ ColourParams() };
+    vector<uint32> colours = colourMap.Colours(FieldKind::EscapeTime);
+    PngEncoder encoder(EncoderPreset::Balanced, DeflateBackend::Parallel);
+    filesystem::path path = filesystem::temp_directory_path() / "julia-benchmark.png";
+    vector<vector<float64>> rows(ThreadCount(), vector<float64>(large.width));
+    auto renderRow = [&](int32 j, int32 thread, IterationField& target, int32 targetRow)
+    {
+        RenderRow(FractalType::Julia, large, j, { -0.8, 0.156, 2 }, OrbitTrap(), 4, BenchmarkIterations, rows[thread].data());
+        float32* values = target.Row(targetRow);
+        for (int32 i = 0; i < large.width; i++)
+            values[i] = (float32)rows[thread][i];
+    };
+
+    IterationField field;
+    field.maxIterations = BenchmarkIterations;
+    field.Allocate(large.width, large.height);
+    vector<uint8> image((size_t)large.width * large.height * 4);
+    int32 bandRows = PngWriter::CacheBandRows(large.width);
+    int32 bandCount = (large.height + bandRows - 1) / bandRows;
+    auto separateFrame = [&]()
+    {
+        ParallelFor(large.height, [&](int64 j, int32 thread) { renderRow((int32)j, thread, field, (int32)j); });
+        ParallelFor(large.height, [&](int64 j, int32 thread) { colourMap.ColourRows(field, (int32)j, 1, image.data() + (size_t)large.width * j * 4); });
+        PngWriter writer;
+        string error;
+        writer.Open(path, large.width, large.height, encoder, colours, error);
+        ParallelFor(bandCount, [&](int64 band, int32 thread)
+        {
+            int32 firstRow = (int32)band * bandRows;
+            string bandError;
+            writer.WriteBand(firstRow, image.data() + (size_t)large.width * firstRow * 4, min(bandRows, large.height - firstRow), bandError);
+        });
+        writer.Close(error);
+    };
+
+    int32 fusedBandRows = (bandRows + 7) & ~7;  // As in Main, bands of a band field keep the rows of the dither pattern
+    int32 fusedBandCount = (large.height + fusedBandRows - 1) / fusedBandRows;
+    vector<IterationField> threadFields(ThreadCount());
+    for (IterationField& threadField : threadFields)
+    {
+        threadField.maxIterations = BenchmarkIterations;
+        threadField.Allocate(large.width, fusedBandRows);
+    }
+    vector<vector<uint8>> bands(ThreadCount(), vector<uint8>((size_t)large.width * fusedBandRows * 4));
+    auto fusedFrame = [&]()
+    {
+        PngWriter writer;
+        string error;
+        writer.Open(path, large.width, large.height, encoder, colours, error);
+        ParallelFor(fusedBandCount, [&](int64 band, int32 thread)
+        {
+            int32 firstRow = (int32)band * fusedBandRows;
+            int32 rowCount = min(fusedBandRows, large.height - firstRow);
+            for (int32 j = 0; j < rowCount; j++)
+                renderRow(firstRow + j, thread, threadFields[thread], j);
+            colourMap.ColourRows(threadFields[thread], 0, rowCount, bands[thread].data());
+            string bandError;
+            writer.WriteBand(firstRow, bands[thread].data(), rowCount, bandError);
+        });
+        writer.Close(error);
+    };
+
+    float64 separate = Time(separateFrame);
+    float64 fused = Time(fusedFrame);
+    uint64 separateTraffic = 0;
+    uint64 fusedTraffic = 0;
+    bool measured = MemoryTraffic(separateFrame, separateTraffic) && MemoryTraffic(fusedFrame, fusedTraffic);
+    filesystem::remove(path);
+
+    Report("One step at a time", separate);
+    if (measured)
+        cout << format("{:<32}{:>10.1f}MB read from memory", "", separateTraffic / 1e6) << endl;
+    Report("Fused bands", fused, separate);
+    if (measured)
+        cout << format("{:<32}{:>10.1f}MB read from memory{:>+7.1f}%", "", fusedTraffic / 1e6, ((float64)fusedTraffic / separateTraffic - 1) * 100) << endl;
+    else
+    {
+        // One after the other, the field is written and read back to colour it, and the image to encode it
+        // Fused, the band fields and images stay in cache
+        uint64 pixels = (uint64)large.width * large.height;
+        cout << format("No hardware counters, traffic estimated at {:.1f}MB one step at a time and none fused",
+            pixels * (sizeof(float32) * 2 + 4 * 2) / 1e6) << endl;
+    }
+    cout << endl;
+}
+
+int32 main()
+{
+    Viewport viewport = { 512, 512, 1, 1, 0, 0, true };
+    cout << format("{}x{} pixels, {} iterations, best of {} runs\n", viewport.width, viewport.height, BenchmarkIterations, BenchmarkRuns) << endl;
+
+    BenchmarkOrbitTraps(viewport);
+    BenchmarkColouring(viewport);
+    BenchmarkEncoding(viewport);
+    BenchmarkPipeline(viewport);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+#include "Types.h"
+
+// Integers of the file formats that are written a byte at a time
+
+// PNG and QOI store them big endian
+inline void WriteUint32(uint8* out, uint32 value)
+{
+    out[0] = (uint8)(value >> 24);
+    out[1] = (uint8)(value >> 16);
+    out[2] = (uint8)(value >> 8);
+    out[3] = (uint8)value;
+}
+
+inline void WriteUint16(uint8* out, uint32 value)
+{
+    out[0] = (uint8)(value >> 8);
+    out[1] = (uint8)value;
+}
+
+// OpenEXR and TIFF store them little endian, as the machines this builds for do, so their bytes are copied as they are
+template<typename T>
+inline void AppendLittleEndian(std::vector<uint8>& out, T item)
+{
+    size_t at = out.size();
+    out.resize(at + sizeof(T));
+    memcpy(&out[at], &item, sizeof(T));
+}
@@ -0,0 +1,279 @@
+#include "Colour.h"
+#include "Newton.h"
+#include "Parallel.h"
+
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+static const array<float64, 3> DefaultNewtonColours[] = { { 1, 0.2, 0.2 }, { 0.2, 1, 0.2 }, { 0.2, 0.4, 1 }, { 1, 1, 0.2 }, { 1, 0.2, 1 }, { 0.2, 1, 1 } };
+
+Palette::Palette(const vector<PaletteStop>& stops)
+    : entries(Size), wideEntries(Size), floatEntries((size_t)Size * 4)
+{
+    size_t stop = 0;
+    for (int32 k = 0; k < Size; k++)
+    {
+        float64 value = (float64)k / (Size - 1);
+        while (stop + 1 < stops.size() && stops[stop + 1].position <= value)
+            stop++;
+
+        // Values outside the stops take the colour of the nearest end
+        const PaletteStop& from = stops[stop];
+        const PaletteStop& to = stop + 1 < stops.size() ? stops[stop + 1] : from;
+        float64 t = to.position > from.position ? clamp((value - from.position) / (to.position - from.position), 0.0, 1.0) : 0;
+
+        float64 colour[4] = { lerp(from.r, to.r, t), lerp(from.g, to.g, t), lerp(from.b, to.b, t), lerp(from.a, to.a, t) };
+        uint8 pixel[4];
+        uint8 widePixel[8];
+        for (int32 c = 0; c < 4; c++)
+        {
+            pixel[c] = (uint8)(colour[c] * 255);
+            uint16 wide = (uint16)(clamp(colour[c], 0.0, 1.0) * 65535 + 0.5);
+            widePixel[c * 2] = (uint8)(wide >> 8);
+            widePixel[c * 2 + 1] = (uint8)wide;
+            floatEntries[(size_t)k * 4 + c] = (float32)colour[c];
+        }
+        memcpy(&entries[k], pixel, 4);
+        memcpy(&wideEntries[k], widePixel, 8);
+    }
+}
+
+// Fades from the background to colour, which is how frames were coloured before palettes
+static vector<PaletteStop> FalloffStops(const ColourParams& colours, const array<float64, 3>& colour)
+{
+    return {
+        { 0, colours.backgroundR, colours.backgroundG, colours.backgroundB, colours.backgroundA },
+        { 1, colour[0], colour[1], colour[2], 1 }
+    };
+}
+
+ColourMap::ColourMap(const ColourParams& colours)
+    : colours(colours), palette(colours.palette.empty() ? FalloffStops(colours, { colours.falloffR, colours.falloffG, colours.falloffB }) : colours.palette)
+{
+    // Roots past the configured colours cycle through the defaults, so this covers every root
+    for (const array<float64, 3>& colour : colours.newtonColours)
+        rootPalettes.emplace_back(FalloffStops(colours, colour));
+    for (const array<float64, 3>& colour : DefaultNewtonColours)
+        rootPalettes.emplace_back(FalloffStops(colours, colour));
+}
+
+const Palette& ColourMap::RootPalette(uint8 root) const
+{
+    size_t configured = colours.newtonColours.size();
+    if (root < configured)
+        return rootPalettes[root];
+    return rootPalettes[configured + root % size(DefaultNewtonColours)];
+}
+
+// Value between 0 and 1 that picks the palette entry of a pixel, for every value but -1
+float64 ColourMap::Normalize(const IterationField& field, float32 value) const
+{
+    // Orbit traps give a distance, which is brightest where the orbit passes closest to the trap
+    if (field.kind == FieldKind::OrbitTrap)
+        return colours.orbitTrapFalloff / (value + colours.orbitTrapFalloff);
+
+    // Only the order of the values matters to the histogram, so it spreads them evenly instead of favouring low values
+    if (colours.mode == ColourMode::Histogram)
+        return value / (float64)field.maxIterations;
+    return value / (value + colours.falloffStrength);
+}
+
+void ColourMap::Equalize(const IterationField& field)
+{
+    // Every thread counts into its own histogram so no counter is shared
+    vector<vector<uint64>> histograms(ThreadCount(), vector<uint64>(Palette::Size));
+    ParallelFor(field.height, [&](int64 j, int32 thread)
+    {
+        uint64* histogram = histograms[thread].data();
+        const float32* values = field.Row((int32)j);
+        for (int32 i = 0; i < field.width; i++)
+        {
+            // Points that never escaped keep their fixed brightness and would only skew the histogram
+            if (values[i] != -1 || field.kind == FieldKind::OrbitTrap)
+                histogram[Palette::Index(Normalize(field, values[i]))]++;
+        }
+    });
+
+    // The histograms are merged and summed up in blocks of entries at once, then each block is offset by the blocks before it
+    constexpr int32 BlockSize = 4096;
+    constexpr int32 BlockCount = Palette::Size / BlockSize;
+    vector<uint64> sums(Palette::Size);
+    array<uint64, BlockCount + 1> blockOffsets = {};
+    ParallelFor(BlockCount, [&](int64 block, int32 thread)
+    {
+        uint64 sum = 0;
+        for (int32 k = (int32)block * BlockSize; k < (int32)(block + 1) * BlockSize; k++)
+        {
+            for (const vector<uint64>& histogram : histograms)
+                sum += histogram[k];
+            sums[k] = sum;
+        }
+        blockOffsets[block + 1] = sum;
+    });
+    for (int32 block = 0; block < BlockCount; block++)
+        blockOffsets[block + 1] += blockOffsets[block];
+
+    // Pixels in the lowest entry that has any are moved to the background, so the whole palette is used
+    uint64 total = blockOffsets[BlockCount];
+    uint64 lowest = 0;
+    for (int32 block = 0; block < BlockCount && lowest == 0; block++)
+    {
+        for (int32 k = block * BlockSize; k < (block + 1) * BlockSize && lowest == 0; k++)
+            lowest = sums[k] + blockOffsets[block];
+    }
+
+    bool smooth = !distribution.empty();
+    distribution.resize(Palette::Size);
+    equalized.resize(Palette::Size);
+    ParallelFor(BlockCount, [&](int64 block, int32 thread)
+    {
+        for (int32 k = (int32)block * BlockSize; k < (int32)(block + 1) * BlockSize; k++)
+        {
+            uint64 sum = sums[k] + blockOffsets[block];
+            float64 share = sum > lowest ? (float64)(sum - lowest) / (float64)(total - lowest) : 0;
+            distribution[k] = smooth ? lerp(share, distribution[k], colours.histogramSmoothing) : share;
+            equalized[k] = (uint16)Palette::Index(distribution[k]);
+        }
+    });
+}
+
+// Position along the palette of pixels that never escaped, which are set to a defined value
+float64 ColourMap::NonEscapingPosition(const IterationField& field) const
+{
+    // The histogram has no escape time to relate the value to, so it is used as the brightness directly
+    if (colours.mode == ColourMode::Histogram)
+        return colours.nonEscapingValue;
+    return Normalize(field, (float32)(colours.nonEscapingValue * (float64)field.maxIterations));
+}
+
+void ColourMap::ColourRows(const IterationField& field, int32 firstRow, int32 rowCount, uint8* rgba) const
+{
+    int32 nonEscapingEntry = NonEscapingEntry(field);
+    for (int32 j = firstRow; j < firstRow + rowCount; j++)
+    {
+        const float32* values = field.Row(j);
+        uint32* pixels = (uint32*)rgba + (size_t)field.width * (j - firstRow);
+
+        // Newton fractals use the palette of the root the pixel converged to
+        const uint8* roots = field.kind == FieldKind::Newton ? field.RootRow(j) : nullptr;
+        for (int32 i = 0; i < field.width; i++)
+        {
+            int32 index = Entry(field, values[i], nonEscapingEntry);
+            if (roots && roots[i] != NewtonFractal::NoRoot)
+                pixels[i] = RootPalette(roots[i]).At(index);
+            else
+                pixels[i] = palette.At(index);
+        }
+    }
+}
+
+void ColourMap::ColourRows16(const IterationField& field, int32 firstRow, int32 rowCount, uint8* rgba) const
+{
+    int32 nonEscapingEntry = NonEscapingEntry(field);
+    for (int32 j = firstRow; j < firstRow + rowCount; j++)
+    {
+        const float32* values = field.Row(j);
+        uint64* pixels = (uint64*)rgba + (size_t)field.width * (j - firstRow);
+        const uint8* roots = field.kind == FieldKind::Newton ? field.RootRow(j) : nullptr;
+        for (int32 i = 0; i < field.width; i++)
+        {
+            int32 index = Entry(field, values[i], nonEscapingEntry);
+            if (roots && roots[i] != NewtonFractal::NoRoot)
+                pixels[i] = RootPalette(roots[i]).At16(index);
+            else
+                pixels[i] = palette.At16(index);
+        }
+    }
+}
+
+void ColourMap::ColourRowsFloat(const IterationField& field, int32 firstRow, int32 rowCount, float32* rgba) const
+{
+    float64 nonEscapingPosition = NonEscapingPosition(field);
+    for (int32 j = firstRow; j < firstRow + rowCount; j++)
+    {
+        const float32* values = field.Row(j);
+        float32* pixels = rgba + (size_t)field.width * (j - firstRow) * 4;
+        const uint8* roots = field.kind == FieldKind::Newton ? field.RootRow(j) : nullptr;
+        for (int32 i = 0; i < field.width; i++)
+        {
+            float64 position = Position(field, values[i], nonEscapingPosition);
+            if (roots && roots[i] != NewtonFractal::NoRoot)
+                RootPalette(roots[i]).Sample(position, pixels + (size_t)i * 4);
+            else
+                palette.Sample(position, pixels + (size_t)i * 4);
+        }
+    }
+}
+
+// 8x8 Bayer matrix, every threshold from 0 to 63 once, spread so that neighbouring thresholds are far apart
+static constexpr uint8 DitherThresholds[8][8] =
+{
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+void ColourMap::IndexRows(const IterationField& field, int32 firstRow, int32 rowCount, bool dither, uint8* indices) const
+{
+    // An entry k of the palette sits at k * 255 / (Size - 1) of the 256 colours
+    // Rounding to the nearest adds half a step, dithering adds a threshold between 0 and 1 instead, as 128ths of a step
+    constexpr uint32 Step = Palette::Size - 1;
+    int32 nonEscapingEntry = NonEscapingEntry(field);
+    for (int32 j = firstRow; j < firstRow + rowCount; j++)
+    {
+        const float32* values = field.Row(j);
+        uint8* row = indices + (size_t)field.width * (j - firstRow);
+        if (!dither)
+        {
+            for (int32 i = 0; i < field.width; i++)
+                row[i] = (uint8)(((uint32)Entry(field, values[i], nonEscapingEntry) * 255 + Step / 2) / Step);
+            continue;
+        }
+
+        const uint8* thresholds = DitherThresholds[j & 7];
+        for (int32 i = 0; i < field.width; i++)
+        {
+            uint32 position = (uint32)Entry(field, values[i], nonEscapingEntry) * 255 * 128 + (thresholds[i & 7] * 2 + 1) * Step;
+            row[i] = (uint8)min<uint32>(position / (Step * 128), 255);
+        }
+    }
+}
+
+vector<uint32> ColourMap::IndexedPalette() const
+{
+    vector<uint32> entries(256);
+    for (int32 k = 0; k < 256; k++)
+        entries[k] = palette[k / 255.0];
+    return entries;
+}
+
+vector<uint32> ColourMap::Colours(FieldKind kind) const
+{
+    // Neighbouring entries of a gradient are mostly the same colour, so runs are dropped before sorting
+    vector<uint32> pixels;
+    auto add = [&](const Palette& from)
+    {
+        for (int32 k = 0; k < Palette::Size; k++)
+        {
+            if (pixels.empty() || pixels.back() != from.At(k))
+                pixels.push_back(from.At(k));
+        }
+    };
+    add(palette);
+    if (kind == FieldKind::Newton)
+    {
+        for (const Palette& rootPalette : rootPalettes)
+            add(rootPalette);
+    }
+
+    sort(pixels.begin(), pixels.end());
+    pixels.erase(unique(pixels.begin(), pixels.end()), pixels.end());
+    return pixels;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "Types.h"
+#include "Field.h"
+
+// A colour of a gradient palette, at a position between 0 (the background) and 1 (the brightest pixels)
+struct PaletteStop
+{
+    float64 position = 0;
+    float64 r = 0, g = 0, b = 0, a = 1;
+};
+
+enum class ColourMode
+{
+    Falloff,   // Brightness follows the escape time through FalloffStrength
+    Histogram  // Brightness follows the rank of the escape time among the frame's pixels, so every frame uses the whole palette
+};
+
+struct ColourParams
+{
+    ColourMode mode = ColourMode::Falloff;
+    float64 histogramSmoothing = 0;  // Share of the previous frame's histogram kept in each frame, 0 to 1
+    float64 falloffStrength = 15;
+    float64 falloffR = 1, falloffG = 1, falloffB = 1;
+    float64 backgroundR = 0, backgroundG = 0, backgroundB = 0, backgroundA = 1;
+    float64 nonEscapingValue = 0;
+    float64 orbitTrapFalloff = 0.05;
+    std::vector<PaletteStop> palette;                   // Sorted by position, empty fades from the background to the falloff colour
+    std::vector<std::array<float64, 3>> newtonColours;  // Roots past the end of the list get a default colour
+};
+
+// Gradient sampled into a table of packed RGBA pixels, so colouring a pixel is a single lookup
+class Palette
+{
+public:
+    static constexpr int32 Size = 65536;
+
+    explicit Palette(const std::vector<PaletteStop>& stops);
+
+    // Entry closest to a value between 0 and 1
+    static int32 Index(float64 value)
+    {
+        // Written so NaN maps to the background as well
+        return value > 0 ? (int32)(std::min(value, 1.0) * (Size - 1) + 0.5) : 0;
+    }
+
+    // Pixel for a value between 0 and 1, in the byte order of the image (R, G, B, A)
+    uint32 operator[](float64 value) const { return entries[Index(value)]; }
+    uint32 At(int32 index) const { return entries[index]; }
+
+    // Entry at 16 bits per channel, in the byte order of 16-bit PNG rows (R, G, B, A, each most significant byte first)
+    uint64 At16(int32 index) const { return wideEntries[index]; }
+
+    // Colour at a value between 0 and 1 as floats, interpolated between the entries either side of it, so the value
+    // keeps its full precision instead of being rounded to the nearest entry
+    void Sample(float64 value, float32* rgba) const
+    {
+        float64 position = value > 0 ? std::min(value, 1.0) * (Size - 1) : 0;
+        int32 index = std::min((int32)position, Size - 2);
+        float32 t = (float32)(position - index);
+        const float32* from = &floatEntries[(size_t)index * 4];
+        for (int32 c = 0; c < 4; c++)
+            rgba[c] = from[c] + (from[c + 4] - from[c]) * t;
+    }
+
+private:
+    std::vector<uint32> entries;
+    std::vector<uint64> wideEntries;
+    std::vector<float32> floatEntries;  // R, G, B, A of each entry
+};
+
+// Every palette a frame can need, built once up front instead of per pixel
+class ColourMap
+{
+public:
+    explicit ColourMap(const ColourParams& colours);
+
+    // Builds the histogram of a frame's field, needed before colouring it in Histogram mode
+    // Successive calls blend each histogram with the previous one by the histogram smoothing
+    void Equalize(const IterationField& field);
+
+    // Maps rows of an iteration field to RGBA pixels, rgba points at the first pixel of firstRow
+    void ColourRows(const IterationField& field, int32 firstRow, int32 rowCount, uint8* rgba) const;
+
+    // Maps rows of an iteration field to 16-bit RGBA pixels, 8 bytes each in the byte order of 16-bit PNG rows
+    void ColourRows16(const IterationField& field, int32 firstRow, int32 rowCount, uint8* rgba) const;
+
+    // Maps rows of an iteration field to float RGBA pixels between 0 and 1, with the full precision of the field's values
+    void ColourRowsFloat(const IterationField& field, int32 firstRow, int32 rowCount, float32* rgba) const;
+
+    // Maps rows of an iteration field to entries of IndexedPalette, one byte per pixel, instead of RGBA pixels
+    // Dithering spreads the rounding to the nearest entry over neighbouring pixels with an ordered pattern, which hides the
+    // steps between entries on gradients that change faster than 256 colours can follow
+    // The root colours of Newton fractals are left out, only the main gradient is used
+    void IndexRows(const IterationField& field, int32 firstRow, int32 rowCount, bool dither, uint8* indices) const;
+
+    // 256 colours spread evenly along the gradient, packed like the pixels, for IndexRows
+    std::vector<uint32> IndexedPalette() const;
+
+    // Every pixel ColourRows can give a field of this kind, packed like the pixels, sorted and without repeats
+    // Frames are made of these alone, so the PNG colour type can be picked from them instead of from every pixel
+    std::vector<uint32> Colours(FieldKind kind) const;
+
+private:
+    const Palette& RootPalette(uint8 root) const;
+    float64 Normalize(const IterationField& field, float32 value) const;
+    float64 NonEscapingPosition(const IterationField& field) const;
+    int32 NonEscapingEntry(const IterationField& field) const { return Palette::Index(NonEscapingPosition(field)); }
+
+    // Palette entry of a pixel's value
+    int32 Entry(const IterationField& field, float32 value, int32 nonEscapingEntry) const
+    {
+        if (value == -1 && field.kind != FieldKind::OrbitTrap)
+            return nonEscapingEntry;
+        int32 index = Palette::Index(Normalize(field, value));
+        return colours.mode == ColourMode::Histogram ? equalized[index] : index;
+    }
+
+    // Position of a pixel's value along the palette, which Entry rounds to the nearest entry
+    float64 Position(const IterationField& field, float32 value, float64 nonEscapingPosition) const
+    {
+        if (value == -1 && field.kind != FieldKind::OrbitTrap)
+            return nonEscapingPosition;
+        float64 position = Normalize(field, value);
+        return colours.mode == ColourMode::Histogram ? distribution[Palette::Index(position)] : position;
+    }
+
+    ColourParams colours;
+    Palette palette;
+    std::vector<Palette> rootPalettes;  // Newton only, one per configured root colour followed by the default colours
+
+    // Histogram mode only, both are indexed by palette entry
+    std::vector<float64> distribution;  // Share of the pixels at or below each entry, smoothed across frames
+    std::vector<uint16> equalized;      // Entry each entry is moved to
+};
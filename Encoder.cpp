@@ -0,0 +1,208 @@
+#include "Encoder.h"
+#include "ParallelPng.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef JULIA_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+#ifdef JULIA_ZLIB
+// Compression for LodePNGCompressSettings::custom_zlib at the zlib level custom_context points at
+static unsigned ZlibCompress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodePNGCompressSettings* settings)
+{
+    z_stream stream = {};
+    if (deflateInit(&stream, *(const int32*)settings->custom_context) != Z_OK)
+        return 111;
+
+    // Same bound as deflateBound, which can't take sizes past 4 GB on every platform
+    size_t capacity = insize + (insize >> 12) + (insize >> 14) + (insize >> 25) + 64;
+    *out = (unsigned char*)malloc(capacity);  // lodepng frees the output with free()
+    if (!*out)
+    {
+        deflateEnd(&stream);
+        return 83;
+    }
+
+    // zlib counts in 32 bits, so very large frames are handed over a piece at a time
+    constexpr size_t MaxPiece = (size_t)1 << 30;
+    size_t read = 0, written = 0;
+    int32 result = Z_OK;
+    while (result == Z_OK)
+    {
+        stream.next_in = (Bytef*)in + read;
+        stream.avail_in = (uInt)min(insize - read, MaxPiece);
+        stream.next_out = *out + written;
+        stream.avail_out = (uInt)min(capacity - written, MaxPiece);
+        uInt availableIn = stream.avail_in, availableOut = stream.avail_out;
+        result = deflate(&stream, read + availableIn == insize ? Z_FINISH : Z_NO_FLUSH);
+        read += availableIn - stream.avail_in;
+        written += availableOut - stream.avail_out;
+    }
+    deflateEnd(&stream);
+    *outsize = written;
+    return result == Z_STREAM_END ? 0 : 111;
+}
+#endif
+
+PngEncoder::PngEncoder(EncoderPreset preset, DeflateBackend backend)
+    : backend(backend)
+{
+    // Filtering is cheap next to deflate and makes every preset but Store much smaller
+    LodePNGEncoderSettings& settings = state.encoder;
+    LodePNGCompressSettings& zlib = settings.zlibsettings;
+    settings.custom_filter = ParallelFilter;
+    settings.filter_strategy = LFS_MINSUM;
+    zlib.windowsize = 32768;
+    switch (preset)
+    {
+    case EncoderPreset::Store:
+        settings.filter_strategy = LFS_ZERO;
+        zlib.btype = 0;
+        zlibLevel = 0;
+        break;
+    case EncoderPreset::Fast:
+        zlib.fast_lz77 = 1;
+        zlib.windowsize = 8192;
+        zlib.max_chain_length = 16;
+        zlib.nicematch = 64;
+        zlib.lazymatching = 0;
+        zlibLevel = 1;
+        break;
+    case EncoderPreset::Balanced:
+        zlib.fast_lz77 = 1;
+        zlib.max_chain_length = 32;
+        zlib.nicematch = 128;
+        zlib.lazymatching = 0;
+        zlibLevel = 6;
+        break;
+    case EncoderPreset::Max:
+        settings.filter_strategy = LFS_ENTROPY;
+        zlib.nicematch = 258;
+        zlib.lazymatching = 1;
+        zlibLevel = 9;
+        break;
+    }
+
+    if (backend == DeflateBackend::Parallel)
+        zlib.custom_deflate = ParallelDeflate;
+#ifdef JULIA_ZLIB
+    if (backend == DeflateBackend::Zlib)
+        zlib.custom_zlib = ZlibCompress;
+#endif
+}
+
+PngEncoder PngEncoder::SingleThreaded() const
+{
+    PngEncoder encoder = *this;
+    encoder.state.encoder.custom_filter = nullptr;
+    if (backend == DeflateBackend::Parallel)
+    {
+        encoder.state.encoder.zlibsettings.custom_deflate = nullptr;
+        encoder.backend = DeflateBackend::Lodepng;
+    }
+    return encoder;
+}
+
+bool PngEncoder::HasZlib()
+{
+#ifdef JULIA_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint32 PngEncoder::ChooseColourType(const vector<uint32>& colours, int32 width, int32 height, bool wholeBytes, LodePNGColorMode& mode)
+{
+    // The colours are scanned as a one row image, then counted as if every pixel of the real one was scanned
+    LodePNGColorStats stats;
+    lodepng_color_stats_init(&stats);
+    LodePNGColorMode rgba = lodepng_color_mode_make(LCT_RGBA, 8);
+    if (uint32 error = lodepng_compute_color_stats(&stats, (const uint8*)colours.data(), (unsigned)colours.size(), 1, &rgba))
+        return error;
+    stats.numpixels = (size_t)width * height;
+    if (wholeBytes)
+        stats.bits = max(stats.bits, 8u);
+    uint32 error = lodepng_auto_choose_color(&mode, &rgba, &stats);
+
+    // Palette indices are the same at any bit depth
+    if (wholeBytes && mode.colortype == LCT_PALETTE)
+        mode.bitdepth = 8;
+    return error;
+}
+
+uint32 PngEncoder::Encode(const vector<uint8>& image, int32 width, int32 height, const vector<uint32>& colours, vector<uint8>& png) const
+{
+    // lodepng writes the chosen colour type back into the state, so each frame starts from a copy
+    lodepng::State frameState = state;
+    frameState.encoder.zlibsettings.custom_context = &zlibLevel;
+    if (!colours.empty())
+    {
+        if (uint32 error = ChooseColourType(colours, width, height, false, frameState.info_png.color))
+            return error;
+        frameState.encoder.auto_convert = 0;
+    }
+    return lodepng::encode(png, image, width, height, frameState);
+}
+
+uint32 PngEncoder::EncodeIndexed(const vector<uint8>& indices, int32 width, int32 height, const vector<uint32>& palette, vector<uint8>& png) const
+{
+    // The pixels are already in the colour type of the file, so lodepng neither searches nor converts them
+    LodePNGColorMode paletteType;
+    lodepng_color_mode_init(&paletteType);
+    uint32 error = MakePalette(palette, paletteType);
+    if (!error)
+        error = Encode(indices, width, height, paletteType, paletteType, png);
+    lodepng_color_mode_cleanup(&paletteType);
+    return error;
+}
+
+uint32 PngEncoder::Encode(const vector<uint8>& pixels, int32 width, int32 height, const LodePNGColorMode& raw, const LodePNGColorMode& colourType, vector<uint8>& png) const
+{
+    lodepng::State frameState = state;
+    frameState.encoder.zlibsettings.custom_context = &zlibLevel;
+    frameState.encoder.auto_convert = 0;
+
+    // Indices follow the gradient, so unlike most palette images they are worth filtering
+    if (raw.colortype == LCT_PALETTE)
+        frameState.encoder.filter_palette_zero = 0;
+    if (uint32 error = lodepng_color_mode_copy(&frameState.info_raw, &raw))
+        return error;
+    if (uint32 error = lodepng_color_mode_copy(&frameState.info_png.color, &colourType))
+        return error;
+    return lodepng::encode(png, pixels, width, height, frameState);
+}
+
+uint32 PngEncoder::Compress(const uint8* data, size_t size, vector<uint8>& out) const
+{
+    // lodepng_zlib_compress only uses custom_deflate, custom_zlib is called the way lodepng calls it for PNG data
+    LodePNGCompressSettings settings = state.encoder.zlibsettings;
+    settings.custom_context = &zlibLevel;
+    uint8* buffer = nullptr;
+    size_t bufferSize = 0;
+    uint32 error = settings.custom_zlib
+        ? settings.custom_zlib(&buffer, &bufferSize, data, size, &settings)
+        : lodepng_zlib_compress(&buffer, &bufferSize, data, size, &settings);
+    if (!error)
+        out.assign(buffer, buffer + bufferSize);
+    free(buffer);
+    return error;
+}
+
+uint32 PngEncoder::MakePalette(const vector<uint32>& palette, LodePNGColorMode& mode)
+{
+    lodepng_palette_clear(&mode);
+    mode.colortype = LCT_PALETTE;
+    mode.bitdepth = 8;
+    for (uint32 colour : palette)
+    {
+        const uint8* rgba = (const uint8*)&colour;
+        if (uint32 error = lodepng_palette_add(&mode, rgba[0], rgba[1], rgba[2], rgba[3]))
+            return error;
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+
+#include <lodepng.h>
+
+#include "Types.h"
+
+// File format frames are saved in
+enum class OutputFormat
+{
+    Png,  // Compressed with the Encoder settings
+    Apng, // Every frame in one animated PNG, each stored as only the rectangle that changed
+    Qoi,  // Several times larger than PNG but encodes in a fraction of the time, for frames that go into a video encoder
+    Y4m,  // Every frame in one stream of raw video, for a video encoder reading stdout or a named pipe
+    Pfm,  // Uncompressed float RGB, which keeps the full precision of the colours for grading
+    Exr,  // Uncompressed float RGBA in an OpenEXR file, which keeps the full precision of the colours for grading
+    Tiff  // Tiled BigTIFF deflated with the Encoder settings, rendered and written a tile at a time for the largest prints
+};
+
+// Trade-off between the time spent encoding a frame and the size of the file
+enum class EncoderPreset
+{
+    Store,     // No compression at all, for scratch renders that are thrown away
+    Fast,      // Short match searches in a small window
+    Balanced,  // Short match searches in the whole window
+    Max        // lodepng's full match search and entropy-based filter choice, many times slower than Balanced
+};
+
+// What compresses the filtered image
+enum class DeflateBackend
+{
+    Lodepng,   // lodepng's deflate on one thread
+    Parallel,  // lodepng's deflate in chunks on every thread
+    Zlib       // The system zlib on one thread, only there if zlib was found when building
+};
+
+// Encodes frames to PNG with the settings of a preset, any of which can then be overridden
+class PngEncoder
+{
+public:
+    PngEncoder(EncoderPreset preset, DeflateBackend backend);
+
+    static bool HasZlib();
+
+    // Settings chosen by the preset, ignored by the Zlib backend apart from the filter settings
+    LodePNGEncoderSettings& Settings() { return state.encoder; }
+    const LodePNGEncoderSettings& Settings() const { return state.encoder; }
+    DeflateBackend Backend() const { return backend; }
+
+    // Copy that filters and compresses on the calling thread only, for encoding many small images on every thread at once
+    PngEncoder SingleThreaded() const;
+
+    // Colour type lodepng's auto_convert would pick for a width x height image made of only these colours, without
+    // looking at its pixels, mode must already have been initialised
+    // wholeBytes rules out bit depths below 8, for writers that can't pack several pixels into a byte
+    // Returns a lodepng error code, 0 on success
+    static uint32 ChooseColourType(const std::vector<uint32>& colours, int32 width, int32 height, bool wholeBytes, LodePNGColorMode& mode);
+
+    // colours are every pixel the image can have, as ColourMap::Colours gives them, which saves lodepng a pass over
+    // the image to find them, or empty to have lodepng find them
+    // Returns a lodepng error code, 0 on success
+    uint32 Encode(const std::vector<uint8>& image, int32 width, int32 height, const std::vector<uint32>& colours, std::vector<uint8>& png) const;
+
+    // Encodes an image of one byte indices into palette, as ColourMap::IndexRows gives them, as an 8-bit palette PNG
+    // Returns a lodepng error code, 0 on success
+    uint32 EncodeIndexed(const std::vector<uint8>& indices, int32 width, int32 height, const std::vector<uint32>& palette, std::vector<uint8>& png) const;
+
+    // Encodes pixels given in the raw colour type as a PNG of colourType, for writers that need every image in the same
+    // colour type whatever its pixels, raw palette images are indices as EncodeIndexed takes them
+    // Returns a lodepng error code, 0 on success
+    uint32 Encode(const std::vector<uint8>& pixels, int32 width, int32 height, const LodePNGColorMode& raw, const LodePNGColorMode& colourType, std::vector<uint8>& png) const;
+
+    // Compresses size bytes of data to a zlib stream with the settings of the preset and backend, for formats other
+    // than PNG that use deflate
+    // Returns a lodepng error code, 0 on success
+    uint32 Compress(const uint8* data, size_t size, std::vector<uint8>& out) const;
+
+    // Makes mode an 8-bit palette of these colours, mode must already have been initialised
+    // Returns a lodepng error code, 0 on success
+    static uint32 MakePalette(const std::vector<uint32>& palette, LodePNGColorMode& mode);
+
+private:
+    lodepng::State state;
+    DeflateBackend backend;
+    int32 zlibLevel = 6;
+};
@@ -0,0 +1,255 @@
+#include "Field.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <fstream>
+
+using namespace std;
+
+#pragma region Npy
+
+// Header of a version 1.0 .npy file, padded so the array data starts 64-byte aligned
+static string NpyHeader(const char* descr, int32 width, int32 height)
+{
+    string header = format("{{'descr': '{}', 'fortran_order': False, 'shape': ({}, {}), }}", descr, height, width);
+    size_t total = 10 + header.size() + 1;
+    header.append((64 - total % 64) % 64, ' ');
+    header += '\n';
+
+    uint16 length = (uint16)header.size();
+    return string("\x93NUMPY\x01\x00", 8) + (char)(length & 0xFF) + (char)(length >> 8) + header;
+}
+
+// Reads the header of a mapped .npy file and returns the offset of the array data, or 0 if it isn't a matching array
+static uint64 ReadNpyHeader(const MappedFile& file, const char* descr, size_t elementSize, int32& width, int32& height, string& error)
+{
+    const uint8* data = file.Data();
+    if (file.Size() < 10 || memcmp(data, "\x93NUMPY", 6) != 0 || data[6] != 1)
+    {
+        error = "Not a version 1 .npy file";
+        return 0;
+    }
+
+    uint64 offset = 10 + (data[8] | (data[9] << 8));
+    string header((const char*)data + 10, (size_t)min<uint64>(offset, file.Size()) - 10);
+    if (header.find(format("'descr': '{}'", descr)) == string::npos || header.find("'fortran_order': False") == string::npos)
+    {
+        error = format("Expected a C-ordered '{}' array", descr);
+        return 0;
+    }
+
+    size_t shape = header.find("'shape': (");
+    if (shape == string::npos || sscanf(header.c_str() + shape, "'shape': (%d, %d)", &height, &width) != 2 || width <= 0 || height <= 0)
+    {
+        error = "Expected a two dimensional array";
+        return 0;
+    }
+
+    if (file.Size() < offset + (uint64)width * height * elementSize)
+    {
+        error = "The array is truncated";
+        return 0;
+    }
+    return offset;
+}
+
+// Creates a mapped .npy file and returns a pointer to its array data
+static uint8* CreateNpy(MappedFile& file, const filesystem::path& path, const char* descr, size_t elementSize, int32 width, int32 height, string& error)
+{
+    string header = NpyHeader(descr, width, height);
+    if (!file.Create(path, header.size() + (uint64)width * height * elementSize, error))
+        return nullptr;
+    memcpy(file.Data(), header.data(), header.size());
+    return file.Data() + header.size();
+}
+
+#pragma endregion
+
+static filesystem::path MetadataPath(const filesystem::path& path)
+{
+    return filesystem::path(path).replace_extension(".yml");
+}
+
+static filesystem::path RootsPath(const filesystem::path& path)
+{
+    return path.parent_path() / (path.stem().string() + "_roots.npy");
+}
+
+static const char* FieldKindNames[] = { "EscapeTime", "OrbitTrap", "Newton" };
+
+IterationField::IterationField(IterationField&& other) noexcept
+{
+    *this = move(other);
+}
+
+IterationField& IterationField::operator=(IterationField&& other) noexcept
+{
+    if (this != &other)
+    {
+        CloseFiles();
+        kind = other.kind;
+        width = other.width;
+        height = other.height;
+        maxIterations = other.maxIterations;
+        swap(values, other.values);
+        swap(roots, other.roots);
+        swap(valueStorage, other.valueStorage);
+        swap(rootStorage, other.rootStorage);
+        swap(valueFile, other.valueFile);
+        swap(rootFile, other.rootFile);
+        swap(metadataPath, other.metadataPath);
+        swap(scratchPath, other.scratchPath);
+    }
+    return *this;
+}
+
+IterationField::~IterationField()
+{
+    CloseFiles();
+}
+
+void IterationField::CloseFiles()
+{
+    valueFile.Close();
+    rootFile.Close();
+    if (!scratchPath.empty())
+    {
+        error_code removeError;
+        filesystem::remove(scratchPath, removeError);
+        filesystem::remove(RootsPath(scratchPath), removeError);
+        scratchPath.clear();
+    }
+}
+
+void IterationField::Allocate(int32 newWidth, int32 newHeight)
+{
+    CloseFiles();
+    width = newWidth;
+    height = newHeight;
+    valueStorage.resize((size_t)width * height);
+    rootStorage.resize(kind == FieldKind::Newton ? (size_t)width * height : 0);
+    values = valueStorage.data();
+    roots = rootStorage.data();
+}
+
+bool IterationField::Create(const filesystem::path& path, int32 newWidth, int32 newHeight, const YAML::Node& render, string& error)
+{
+    CloseFiles();
+    valueStorage = {};
+    rootStorage = {};
+    width = newWidth;
+    height = newHeight;
+    metadataPath = MetadataPath(path);
+
+    values = (float32*)CreateNpy(valueFile, path, "<f4", sizeof(float32), width, height, error);
+    if (!values)
+        return false;
+
+    roots = nullptr;
+    rootFile.Close();
+    if (kind == FieldKind::Newton && !(roots = CreateNpy(rootFile, RootsPath(path), "|u1", 1, width, height, error)))
+        return false;
+
+    return Checkpoint(render, 0, error);
+}
+
+bool IterationField::CreateScratch(const filesystem::path& path, int32 newWidth, int32 newHeight, string& error)
+{
+    CloseFiles();
+    valueStorage = {};
+    rootStorage = {};
+    width = newWidth;
+    height = newHeight;
+    metadataPath.clear();
+    scratchPath = path;
+
+    values = (float32*)CreateNpy(valueFile, path, "<f4", sizeof(float32), width, height, error);
+    roots = nullptr;
+    if (values && kind == FieldKind::Newton)
+        roots = CreateNpy(rootFile, RootsPath(path), "|u1", 1, width, height, error);
+    return values && (kind != FieldKind::Newton || roots);
+}
+
+bool IterationField::Open(const filesystem::path& path, bool writable, YAML::Node& render, int32& rowsCompleted, string& error)
+{
+    CloseFiles();
+    valueStorage = {};
+    rootStorage = {};
+    metadataPath = MetadataPath(path);
+
+    try
+    {
+        YAML::Node metadata = YAML::LoadFile(metadataPath.string());
+        string kindName = metadata["Kind"].as<string>();
+        size_t k = 0;
+        while (k < size(FieldKindNames) && kindName != FieldKindNames[k])
+            k++;
+        if (k == size(FieldKindNames))
+        {
+            error = format("Unknown field kind '{}'", kindName);
+            return false;
+        }
+        kind = (FieldKind)k;
+        maxIterations = metadata["MaxIterations"].as<int32>();
+        rowsCompleted = metadata["RowsCompleted"].as<int32>();
+        render = metadata["Render"];
+    }
+    catch (const exception& e)
+    {
+        error = format("Failed to read '{}': {}", metadataPath.string(), e.what());
+        return false;
+    }
+
+    uint64 offset;
+    if (!valueFile.Open(path, writable, error) || !(offset = ReadNpyHeader(valueFile, "<f4", sizeof(float32), width, height, error)))
+        return false;
+    values = (float32*)(valueFile.Data() + offset);
+
+    roots = nullptr;
+    rootFile.Close();
+    if (kind == FieldKind::Newton)
+    {
+        int32 rootsWidth, rootsHeight;
+        if (!rootFile.Open(RootsPath(path), writable, error) || !(offset = ReadNpyHeader(rootFile, "|u1", 1, rootsWidth, rootsHeight, error)))
+            return false;
+        if (rootsWidth != width || rootsHeight != height)
+        {
+            error = format("'{}' does not match the field", RootsPath(path).string());
+            return false;
+        }
+        roots = rootFile.Data() + offset;
+    }
+    return true;
+}
+
+bool IterationField::Checkpoint(const YAML::Node& render, int32 rowsCompleted, string& error)
+{
+    // The rows must be on disk before the metadata claims they are done
+    if (!valueFile.Flush() || (rootFile.IsOpen() && !rootFile.Flush()))
+    {
+        error = format("Failed to write the field next to '{}'", metadataPath.string());
+        return false;
+    }
+
+    YAML::Emitter metadata;
+    metadata << YAML::BeginMap;
+    metadata << YAML::Key << "Kind" << YAML::Value << FieldKindNames[(int32)kind];
+    metadata << YAML::Key << "MaxIterations" << YAML::Value << maxIterations;
+    metadata << YAML::Key << "RowsCompleted" << YAML::Value << rowsCompleted;
+    metadata << YAML::Key << "Render" << YAML::Value << render;
+    metadata << YAML::EndMap;
+
+    // Written to a temporary file first so an interruption never leaves a half written file behind
+    filesystem::path temporaryPath = filesystem::path(metadataPath).concat(".tmp");
+    ofstream(temporaryPath) << metadata.c_str() << endl;
+    error_code renameError;
+    filesystem::rename(temporaryPath, metadataPath, renameError);
+    if (renameError)
+    {
+        error = format("Failed to write '{}': {}", metadataPath.string(), renameError.message());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <yaml-cpp/yaml.h>
+
+#include "Types.h"
+#include "MappedFile.h"
+
+// What the values of an iteration field mean, which decides how it is coloured
+enum class FieldKind : uint8
+{
+    EscapeTime,  // Smoothed escape time, -1 for points that never escaped
+    OrbitTrap,   // Closest distance between the orbit and the trap
+    Newton       // Smoothed iterations to converge, -1 if it never did, with the index of the root in roots
+};
+
+// Raw per-pixel output of the renderer, stored row by row
+// Kept apart from the colouring so a frame can be recoloured without computing it again
+//
+// A field either lives in memory or directly inside a .npy file (float32, height x width) that is mapped into memory,
+// so other tools can map the same file without copying it and fields can be larger than the available RAM
+// Newton root indices go in a second _roots.npy file (uint8) and everything needed to recolour or resume the
+// field in a .yml file next to it, as the .npy header can't hold anything but the array's shape and type
+class IterationField
+{
+public:
+    FieldKind kind = FieldKind::EscapeTime;
+    int32 width = 0;
+    int32 height = 0;
+    int32 maxIterations = 0;
+
+    IterationField() = default;
+    IterationField(IterationField&& other) noexcept;
+    IterationField& operator=(IterationField&& other) noexcept;
+    IterationField(const IterationField&) = delete;
+    IterationField& operator=(const IterationField&) = delete;
+    ~IterationField();
+
+    // Keeps the field in memory
+    void Allocate(int32 newWidth, int32 newHeight);
+
+    // Keeps the field in a new .npy file at path, rows reach the file as they are written
+    // render holds the parameters it is rendered with, which are saved so it can be resumed
+    bool Create(const std::filesystem::path& path, int32 newWidth, int32 newHeight, const YAML::Node& render, std::string& error);
+
+    // Keeps the field in a scratch .npy file at path, for fields larger than the memory they may use
+    // Nothing is saved next to it, and the file is removed once the field is kept anywhere else
+    bool CreateScratch(const std::filesystem::path& path, int32 newWidth, int32 newHeight, std::string& error);
+
+    // Maps a field saved by Create(), render receives the parameters it was rendered with
+    // and rowsCompleted how many rows from the top were done when it was last saved
+    bool Open(const std::filesystem::path& path, bool writable, YAML::Node& render, int32& rowsCompleted, std::string& error);
+
+    // Writes the rows to disk and updates the .yml file, mapped fields only
+    bool Checkpoint(const YAML::Node& render, int32 rowsCompleted, std::string& error);
+
+    bool IsMapped() const { return valueFile.IsOpen(); }
+
+    // Whether the field is mapped to a file that is kept, and so can be checkpointed
+    bool IsSaved() const { return IsMapped() && scratchPath.empty(); }
+
+    float32* Row(int32 j) { return values + (size_t)width * j; }
+    const float32* Row(int32 j) const { return values + (size_t)width * j; }
+    uint8* RootRow(int32 j) { return roots + (size_t)width * j; }
+    const uint8* RootRow(int32 j) const { return roots + (size_t)width * j; }
+
+private:
+    void CloseFiles();
+
+    float32* values = nullptr;
+    uint8* roots = nullptr;  // Newton only
+
+    std::vector<float32> valueStorage;
+    std::vector<uint8> rootStorage;
+    MappedFile valueFile;
+    MappedFile rootFile;
+    std::filesystem::path metadataPath;
+    std::filesystem::path scratchPath;
+};
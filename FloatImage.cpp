@@ -0,0 +1,134 @@
+#include "FloatImage.h"
+#include "Parallel.h"
+#include "Bytes.h"
+
+#include <cstring>
+#include <format>
+#include <fstream>
+
+using namespace std;
+
+// Both formats are little endian, which the pixels are copied in as they are, as for .npy fields
+
+static bool SaveFile(const filesystem::path& path, const vector<uint8>& contents, string& error)
+{
+    ofstream file(path, ios::binary | ios::trunc);
+    file.write((const char*)contents.data(), contents.size());
+    file.close();
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", path.string());
+        return false;
+    }
+    return true;
+}
+
+// Rows are converted a channel at a time in plain loops, which the compiler turns into packed instructions
+static void PremultiplyRow(const float32* rgba, int32 width, float32* r, float32* g, float32* b)
+{
+    for (int32 i = 0; i < width; i++)
+    {
+        float32 alpha = rgba[i * 4 + 3];
+        r[i] = rgba[i * 4] * alpha;
+        g[i] = rgba[i * 4 + 1] * alpha;
+        b[i] = rgba[i * 4 + 2] * alpha;
+    }
+}
+
+bool SavePfm(const filesystem::path& path, int32 width, int32 height, const vector<float32>& rgba, string& error)
+{
+    // A negative scale marks the pixels as little endian, and rows go from the bottom up
+    string header = format("PF\n{} {}\n-1.0\n", width, height);
+    size_t rowBytes = (size_t)width * 3 * sizeof(float32);
+    vector<uint8> contents(header.size() + rowBytes * height);
+    memcpy(contents.data(), header.data(), header.size());
+    // The header leaves the rows unaligned, so each is made in a buffer first
+    vector<vector<float32>> buffers(ThreadCount(), vector<float32>((size_t)width * 6));
+    ParallelFor(height, [&](int64 j, int32 thread)
+    {
+        float32* planes = buffers[thread].data();
+        float32* row = planes + (size_t)width * 3;
+        PremultiplyRow(&rgba[(size_t)width * j * 4], width, planes, planes + width, planes + (size_t)width * 2);
+        for (int32 i = 0; i < width; i++)
+        {
+            row[i * 3] = planes[i];
+            row[i * 3 + 1] = planes[width + i];
+            row[i * 3 + 2] = planes[(size_t)width * 2 + i];
+        }
+        memcpy(contents.data() + header.size() + rowBytes * (height - 1 - j), row, rowBytes);
+    });
+    return SaveFile(path, contents, error);
+}
+
+// Header attributes of OpenEXR, each a name, a type, the size of its value and the value
+static void AddAttribute(vector<uint8>& header, const char* name, const char* type, const vector<uint8>& value)
+{
+    header.insert(header.end(), name, name + strlen(name) + 1);
+    header.insert(header.end(), type, type + strlen(type) + 1);
+    AppendLittleEndian(header, (int32)value.size());
+    header.insert(header.end(), value.begin(), value.end());
+}
+
+bool SaveExr(const filesystem::path& path, int32 width, int32 height, const vector<float32>& rgba, string& error)
+{
+    // Magic number, then version 2 of a single part scanline file
+    vector<uint8> contents = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+
+    // Channels are listed and stored in alphabetical order, each as 32-bit floats sampled at every pixel
+    constexpr int32 FloatType = 2;
+    vector<uint8> channels;
+    for (const char* name : { "A", "B", "G", "R" })
+    {
+        channels.insert(channels.end(), name, name + 2);
+        AppendLittleEndian(channels, FloatType);
+        AppendLittleEndian(channels, (int32)0);  // Not perceptually linear, then 3 reserved bytes
+        AppendLittleEndian(channels, (int32)1);
+        AppendLittleEndian(channels, (int32)1);
+    }
+    channels.push_back(0);
+    AddAttribute(contents, "channels", "chlist", channels);
+    AddAttribute(contents, "compression", "compression", { 0 });
+
+    vector<uint8> window;
+    for (int32 bound : { 0, 0, width - 1, height - 1 })
+        AppendLittleEndian(window, bound);
+    AddAttribute(contents, "dataWindow", "box2i", window);
+    AddAttribute(contents, "displayWindow", "box2i", window);
+    AddAttribute(contents, "lineOrder", "lineOrder", { 0 });  // From the top row down
+
+    vector<uint8> one, centre;
+    AppendLittleEndian(one, 1.0f);
+    AppendLittleEndian(centre, 0.0f);
+    AppendLittleEndian(centre, 0.0f);
+    AddAttribute(contents, "pixelAspectRatio", "float", one);
+    AddAttribute(contents, "screenWindowCenter", "v2f", centre);
+    AddAttribute(contents, "screenWindowWidth", "float", one);
+    contents.push_back(0);
+
+    // Uncompressed files hold a row in each chunk, all the same size, found through a table of their offsets
+    size_t rowBytes = (size_t)width * 4 * sizeof(float32);
+    size_t chunkBytes = 8 + rowBytes;
+    size_t firstChunk = contents.size() + (size_t)height * 8;
+    for (int32 j = 0; j < height; j++)
+        AppendLittleEndian(contents, (uint64)(firstChunk + chunkBytes * j));
+    contents.resize(firstChunk + chunkBytes * height);
+
+    // As with PFM, the header leaves the chunks unaligned
+    vector<vector<float32>> buffers(ThreadCount(), vector<float32>((size_t)width * 4));
+    ParallelFor(height, [&](int64 j, int32 thread)
+    {
+        uint8* chunk = contents.data() + firstChunk + chunkBytes * j;
+        int32 y = (int32)j;
+        int32 dataBytes = (int32)rowBytes;
+        memcpy(chunk, &y, 4);
+        memcpy(chunk + 4, &dataBytes, 4);
+
+        const float32* row = &rgba[(size_t)width * j * 4];
+        float32* planes = buffers[thread].data();
+        for (int32 i = 0; i < width; i++)
+            planes[i] = row[i * 4 + 3];
+        PremultiplyRow(row, width, planes + (size_t)width * 3, planes + (size_t)width * 2, planes + width);
+        memcpy(chunk + 8, planes, rowBytes);
+    });
+    return SaveFile(path, contents, error);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+
+// Uncompressed float images, which keep the full precision of the colouring so a render can be graded without
+// computing it again
+// rgba holds width x height pixels of 4 floats between 0 and 1, from the top row down, with straight alpha as
+// ColourMap::ColourRowsFloat gives them
+// Both formats store colours premultiplied by alpha, which is what OpenEXR expects and, as PFM has no alpha, the
+// image over black
+
+// Saves a PFM file of 32-bit float RGB
+bool SavePfm(const std::filesystem::path& path, int32 width, int32 height, const std::vector<float32>& rgba, std::string& error);
+
+// Saves a scanline OpenEXR file of uncompressed 32-bit float RGBA
+bool SaveExr(const std::filesystem::path& path, int32 width, int32 height, const std::vector<float32>& rgba, std::string& error);
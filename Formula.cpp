@@ -0,0 +1,824 @@
+#include "Formula.h"
+
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <memory>
+
+using namespace std;
+
+#pragma region Expression Tree
+
+enum class NodeType
+{
+    Constant, Z, C, Add, Sub, Mul, Div, Pow, Neg, Function
+};
+
+struct Node
+{
+    NodeType type;
+    complex<float64> value;           // Constant only
+    Formula::OpCode function;         // Function only
+    unique_ptr<Node> left, right;     // Right is only used by binary operators
+
+    bool IsConstant() const { return type == NodeType::Constant; }
+    bool IsConstant(float64 real) const { return type == NodeType::Constant && value == complex<float64>(real, 0); }
+};
+
+static unique_ptr<Node> MakeNode(NodeType type, unique_ptr<Node> left = nullptr, unique_ptr<Node> right = nullptr)
+{
+    auto node = make_unique<Node>();
+    node->type = type;
+    node->left = move(left);
+    node->right = move(right);
+    return node;
+}
+
+static unique_ptr<Node> MakeConstant(complex<float64> value)
+{
+    auto node = MakeNode(NodeType::Constant);
+    node->value = value;
+    return node;
+}
+
+// Integer exponents are strength reduced to squarings and multiplications instead of exp(b * log(a))
+static bool IsIntegerExponent(const Node* node)
+{
+    float64 n = node->value.real();
+    return node->IsConstant() && node->value.imag() == 0 && n == floor(n) && n != 0 && fabs(n) <= 1024;
+}
+
+#pragma endregion
+
+#pragma region Parser
+
+// Recursive descent parser for:
+//   expression = term (('+' | '-') term)*
+//   term       = unary (('*' | '/') unary)*
+//   unary      = '-' unary | power
+//   power      = primary ('^' unary)?
+//   primary    = number | 'z' | 'c' | 'i' | function '(' expression ')' | '(' expression ')'
+class Parser
+{
+public:
+    Parser(const string& source) : source(source) {}
+
+    unique_ptr<Node> Parse(string& error)
+    {
+        // Allow the formula to be written as an assignment to z
+        SkipWhitespace();
+        size_t assignment = source.find('=');
+        if (assignment != string::npos)
+        {
+            size_t start = position;
+            if (Identifier() != "z")
+                return Fail("Formula must assign to 'z'", error);
+            SkipWhitespace();
+            if (position != assignment)
+            {
+                position = start;
+                return Fail("Expected '='", error);
+            }
+            position++;
+        }
+
+        unique_ptr<Node> node = Expression();
+        SkipWhitespace();
+        if (!failure.empty() || position != source.size())
+            return Fail(failure.empty() ? "Unexpected character" : failure, error);
+        return node;
+    }
+
+private:
+    const string& source;
+    size_t position = 0;
+    string failure;
+
+    unique_ptr<Node> Fail(const string& message, string& error)
+    {
+        error = format("{} at column {} of '{}'", message, position + 1, source);
+        return nullptr;
+    }
+
+    unique_ptr<Node> Error(const string& message)
+    {
+        if (failure.empty())
+            failure = message;
+        return nullptr;
+    }
+
+    void SkipWhitespace()
+    {
+        while (position < source.size() && isspace((unsigned char)source[position]))
+            position++;
+    }
+
+    bool Accept(char c)
+    {
+        SkipWhitespace();
+        if (position < source.size() && source[position] == c)
+        {
+            position++;
+            return true;
+        }
+        return false;
+    }
+
+    string Identifier()
+    {
+        size_t start = position;
+        while (position < source.size() && isalpha((unsigned char)source[position]))
+            position++;
+        return source.substr(start, position - start);
+    }
+
+    unique_ptr<Node> Expression()
+    {
+        unique_ptr<Node> node = Term();
+        while (node)
+        {
+            if (Accept('+'))
+                node = MakeNode(NodeType::Add, move(node), Term());
+            else if (Accept('-'))
+                node = MakeNode(NodeType::Sub, move(node), Term());
+            else
+                break;
+            if (!node->right) return nullptr;
+        }
+        return node;
+    }
+
+    unique_ptr<Node> Term()
+    {
+        unique_ptr<Node> node = Unary();
+        while (node)
+        {
+            if (Accept('*'))
+                node = MakeNode(NodeType::Mul, move(node), Unary());
+            else if (Accept('/'))
+                node = MakeNode(NodeType::Div, move(node), Unary());
+            else
+                break;
+            if (!node->right) return nullptr;
+        }
+        return node;
+    }
+
+    unique_ptr<Node> Unary()
+    {
+        if (Accept('-'))
+        {
+            unique_ptr<Node> operand = Unary();
+            return operand ? MakeNode(NodeType::Neg, move(operand)) : nullptr;
+        }
+        return Power();
+    }
+
+    unique_ptr<Node> Power()
+    {
+        unique_ptr<Node> node = Primary();
+        if (node && Accept('^'))
+        {
+            unique_ptr<Node> exponent = Unary();
+            return exponent ? MakeNode(NodeType::Pow, move(node), move(exponent)) : nullptr;
+        }
+        return node;
+    }
+
+    unique_ptr<Node> Primary()
+    {
+        SkipWhitespace();
+        if (position >= source.size())
+            return Error("Unexpected end of formula");
+
+        char c = source[position];
+        if (Accept('('))
+        {
+            unique_ptr<Node> node = Expression();
+            if (node && !Accept(')'))
+                return Error("Expected ')'");
+            return node;
+        }
+
+        if (isdigit((unsigned char)c) || c == '.')
+        {
+            size_t length = 0;
+            float64 value;
+            try { value = stod(source.substr(position), &length); }
+            catch (const exception&) { return Error("Invalid number"); }
+            position += length;
+            return MakeConstant(value);
+        }
+
+        if (isalpha((unsigned char)c))
+        {
+            string name = Identifier();
+            if (name == "z") return MakeNode(NodeType::Z);
+            if (name == "c") return MakeNode(NodeType::C);
+            if (name == "i") return MakeConstant(complex<float64>(0, 1));
+
+            static const pair<const char*, Formula::OpCode> functions[] =
+            {
+                { "sqrt", Formula::OpCode::Sqrt }, { "exp", Formula::OpCode::Exp }, { "log", Formula::OpCode::Log },
+                { "sin", Formula::OpCode::Sin }, { "cos", Formula::OpCode::Cos }, { "sinh", Formula::OpCode::Sinh },
+                { "cosh", Formula::OpCode::Cosh }, { "conj", Formula::OpCode::Conj }, { "abs", Formula::OpCode::Abs }
+            };
+            for (auto& [functionName, op] : functions)
+            {
+                if (name != functionName)
+                    continue;
+                if (!Accept('('))
+                    return Error(format("Expected '(' after '{}'", name));
+                unique_ptr<Node> argument = Expression();
+                if (!argument)
+                    return nullptr;
+                if (!Accept(')'))
+                    return Error("Expected ')'");
+                auto node = MakeNode(NodeType::Function, move(argument));
+                node->function = op;
+                return node;
+            }
+
+            position -= name.size();
+            return Error(format("Unknown name '{}'", name));
+        }
+
+        return Error(format("Unexpected '{}'", c));
+    }
+};
+
+#pragma endregion
+
+#pragma region Optimizer
+
+static complex<float64> Evaluate(Formula::OpCode function, complex<float64> x)
+{
+    switch (function)
+    {
+        case Formula::OpCode::Sqrt: return sqrt(x);
+        case Formula::OpCode::Exp:  return exp(x);
+        case Formula::OpCode::Log:  return log(x);
+        case Formula::OpCode::Sin:  return sin(x);
+        case Formula::OpCode::Cos:  return cos(x);
+        case Formula::OpCode::Sinh: return sinh(x);
+        case Formula::OpCode::Cosh: return cosh(x);
+        case Formula::OpCode::Conj: return conj(x);
+        case Formula::OpCode::Abs:  return abs(x);
+        default:                    return x;
+    }
+}
+
+// Folds constant subexpressions and removes identities such as x * 1 and x + 0
+static unique_ptr<Node> Fold(unique_ptr<Node> node)
+{
+    if (node->left) node->left = Fold(move(node->left));
+    if (node->right) node->right = Fold(move(node->right));
+
+    Node* l = node->left.get();
+    Node* r = node->right.get();
+    bool constant = l && l->IsConstant() && (!r || r->IsConstant());
+
+    switch (node->type)
+    {
+        case NodeType::Add:
+            if (constant) return MakeConstant(l->value + r->value);
+            if (l->IsConstant(0)) return move(node->right);
+            if (r->IsConstant(0)) return move(node->left);
+            break;
+        case NodeType::Sub:
+            if (constant) return MakeConstant(l->value - r->value);
+            if (r->IsConstant(0)) return move(node->left);
+            break;
+        case NodeType::Mul:
+            if (constant) return MakeConstant(l->value * r->value);
+            if (l->IsConstant(1)) return move(node->right);
+            if (r->IsConstant(1)) return move(node->left);
+            break;
+        case NodeType::Div:
+            if (constant) return MakeConstant(l->value / r->value);
+            if (r->IsConstant(1)) return move(node->left);
+            break;
+        case NodeType::Pow:
+            if (constant && IsIntegerExponent(r))
+            {
+                // Exact for small integers, unlike the general complex pow
+                complex<float64> value = 1;
+                for (int32 k = 0; k < fabs(r->value.real()); k++)
+                    value *= l->value;
+                return MakeConstant(r->value.real() < 0 ? 1.0 / value : value);
+            }
+            if (constant) return MakeConstant(pow(l->value, r->value));
+            if (r->IsConstant(1)) return move(node->left);
+            if (r->IsConstant(0)) return MakeConstant(1);
+            break;
+        case NodeType::Neg:
+            if (constant) return MakeConstant(-l->value);
+            break;
+        case NodeType::Function:
+            if (constant) return MakeConstant(Evaluate(node->function, l->value));
+            break;
+        default:
+            break;
+    }
+    return node;
+}
+
+// Degree of the expression as a polynomial in z, or -1 if it is not a polynomial
+static float64 Degree(const Node* node)
+{
+    switch (node->type)
+    {
+        case NodeType::Constant:
+        case NodeType::C:
+            return 0;
+        case NodeType::Z:
+            return 1;
+        case NodeType::Neg:
+            return Degree(node->left.get());
+        case NodeType::Add:
+        case NodeType::Sub:
+        {
+            float64 l = Degree(node->left.get()), r = Degree(node->right.get());
+            return l < 0 || r < 0 ? -1 : max(l, r);
+        }
+        case NodeType::Mul:
+        {
+            float64 l = Degree(node->left.get()), r = Degree(node->right.get());
+            return l < 0 || r < 0 ? -1 : l + r;
+        }
+        case NodeType::Div:
+        {
+            float64 l = Degree(node->left.get()), r = Degree(node->right.get());
+            return l < 0 || r != 0 ? -1 : l;
+        }
+        case NodeType::Pow:
+        {
+            float64 l = Degree(node->left.get());
+            const Node* r = node->right.get();
+            return l < 0 || !r->IsConstant() || r->value.imag() != 0 ? -1 : l * r->value.real();
+        }
+        default:
+            return -1;
+    }
+}
+
+#pragma endregion
+
+#pragma region Code Generation
+
+class FormulaCompiler
+{
+public:
+    FormulaCompiler(Formula& formula) : formula(formula) {}
+
+    bool Compile(const Node* root, string& error)
+    {
+        // Constants get fixed registers directly after z and c, temporaries follow them
+        CollectConstants(root);
+        nextRegister = 2 + (int32)formula.constants.size();
+
+        uint8 result;
+        if (!Generate(root, result, error))
+            return false;
+        // The last instruction can write z directly, as every instruction reads a lane's operands before writing it
+        if (!formula.program.empty() && formula.program.back().destination == result)
+            formula.program.back().destination = Formula::RegisterZ;
+        else if (result != Formula::RegisterZ)
+            formula.program.push_back({ Formula::OpCode::Copy, Formula::RegisterZ, result, result });
+
+        formula.registerCount = nextRegister;
+        return true;
+    }
+
+private:
+    Formula& formula;
+    vector<uint8> freeRegisters;
+    int32 nextRegister = 0;
+
+    void CollectConstants(const Node* node)
+    {
+        if (node->IsConstant())
+            AddConstant(node->value);
+
+        if (node->left)
+            CollectConstants(node->left.get());
+
+        if (node->type == NodeType::Pow && IsIntegerExponent(node->right.get()))
+        {
+            // Negative integer powers divide 1 by the power, the exponent itself never needs a register
+            if (node->right->value.real() < 0)
+                AddConstant(1);
+        }
+        else if (node->right)
+            CollectConstants(node->right.get());
+    }
+
+    // Constants are matched bit for bit, as a folded NaN never equals itself and -0 would share the register of 0
+    size_t FindConstant(complex<float64> value) const
+    {
+        auto sameBits = [&](complex<float64> constant)
+        {
+            return bit_cast<uint64>(constant.real()) == bit_cast<uint64>(value.real()) && bit_cast<uint64>(constant.imag()) == bit_cast<uint64>(value.imag());
+        };
+        return find_if(formula.constants.begin(), formula.constants.end(), sameBits) - formula.constants.begin();
+    }
+
+    void AddConstant(complex<float64> value)
+    {
+        if (FindConstant(value) == formula.constants.size())
+            formula.constants.push_back(value);
+    }
+
+    uint8 Constant(complex<float64> value)
+    {
+        return (uint8)(2 + FindConstant(value));
+    }
+
+    bool IsTemporary(uint8 r) const { return r >= 2 + formula.constants.size(); }
+
+    void Release(uint8 r)
+    {
+        if (IsTemporary(r))
+            freeRegisters.push_back(r);
+    }
+
+    bool Allocate(uint8& r, string& error)
+    {
+        if (!freeRegisters.empty())
+        {
+            r = freeRegisters.back();
+            freeRegisters.pop_back();
+            return true;
+        }
+        if (nextRegister >= 256)
+        {
+            error = "Formula is too complex";
+            return false;
+        }
+        r = (uint8)nextRegister++;
+        return true;
+    }
+
+    // Operands are released before the destination is allocated, every instruction reads all of
+    // a lane's operands before writing its result so it may overwrite one of them
+    bool Emit(Formula::OpCode op, uint8 a, uint8 b, uint8& destination, string& error)
+    {
+        Release(a);
+        if (b != a)
+            Release(b);
+        if (!Allocate(destination, error))
+            return false;
+        formula.program.push_back({ op, destination, a, b });
+        return true;
+    }
+
+    // base^n for a positive integer n by left-to-right binary exponentiation
+    bool IntegerPower(uint8 base, int64 n, uint8& result, string& error)
+    {
+        int32 bit = 62;
+        while (!((n >> bit) & 1))
+            bit--;
+
+        uint8 accumulator = base;
+        for (bit--; bit >= 0; bit--)
+        {
+            uint8 destination;
+            if (accumulator != base)
+                Release(accumulator);
+            if (!Allocate(destination, error))
+                return false;
+            formula.program.push_back({ Formula::OpCode::Square, destination, accumulator, accumulator });
+            accumulator = destination;
+
+            if ((n >> bit) & 1)
+            {
+                Release(accumulator);
+                if (!Allocate(destination, error))
+                    return false;
+                formula.program.push_back({ Formula::OpCode::Mul, destination, accumulator, base });
+                accumulator = destination;
+            }
+        }
+
+        if (accumulator != base)
+            Release(base);
+        result = accumulator;
+        return true;
+    }
+
+    bool Generate(const Node* node, uint8& result, string& error)
+    {
+        uint8 a, b;
+        switch (node->type)
+        {
+            case NodeType::Z:
+                result = Formula::RegisterZ;
+                return true;
+            case NodeType::C:
+                result = Formula::RegisterC;
+                return true;
+            case NodeType::Constant:
+                result = Constant(node->value);
+                return true;
+
+            case NodeType::Add:
+            case NodeType::Sub:
+            case NodeType::Mul:
+            case NodeType::Div:
+            {
+                if (!Generate(node->left.get(), a, error) || !Generate(node->right.get(), b, error))
+                    return false;
+                Formula::OpCode op = node->type == NodeType::Add ? Formula::OpCode::Add
+                                   : node->type == NodeType::Sub ? Formula::OpCode::Sub
+                                   : node->type == NodeType::Mul ? (a == b ? Formula::OpCode::Square : Formula::OpCode::Mul)
+                                   : Formula::OpCode::Div;
+                return Emit(op, a, b, result, error);
+            }
+
+            case NodeType::Neg:
+            case NodeType::Function:
+                if (!Generate(node->left.get(), a, error))
+                    return false;
+                return Emit(node->type == NodeType::Neg ? Formula::OpCode::Neg : node->function, a, a, result, error);
+
+            case NodeType::Pow:
+            {
+                if (!Generate(node->left.get(), a, error))
+                    return false;
+
+                // Strength reduction of integer powers to squarings and multiplications
+                const Node* exponent = node->right.get();
+                if (IsIntegerExponent(exponent))
+                {
+                    float64 n = exponent->value.real();
+                    if (!IntegerPower(a, (int64)fabs(n), result, error))
+                        return false;
+                    return n > 0 || Emit(Formula::OpCode::Div, Constant(1), result, result, error);
+                }
+
+                // General power as exp(b * log(a))
+                uint8 logarithm;
+                if (!Emit(Formula::OpCode::Log, a, a, logarithm, error) || !Generate(exponent, b, error))
+                    return false;
+                return Emit(Formula::OpCode::Mul, b, logarithm, result, error) && Emit(Formula::OpCode::Exp, result, result, result, error);
+            }
+        }
+        return false;
+    }
+};
+
+optional<Formula> Formula::Compile(const string& source, string& error)
+{
+    unique_ptr<Node> root = Parser(source).Parse(error);
+    if (!root)
+        return nullopt;
+    root = Fold(move(root));
+
+    Formula formula;
+    float64 degree = Degree(root.get());
+    formula.smoothingExponent = degree >= 2 ? degree : 2;
+
+    if (!FormulaCompiler(formula).Compile(root.get(), error))
+        return nullopt;
+    return formula;
+}
+
+static const char* OpCodeName(Formula::OpCode op)
+{
+    static const char* names[] = { "copy", "add", "sub", "mul", "div", "neg", "square", "conj", "abs", "sqrt", "exp", "log", "sin", "cos", "sinh", "cosh" };
+    return names[(int32)op];
+}
+
+string Formula::Disassemble() const
+{
+    string listing;
+    for (size_t k = 0; k < constants.size(); k++)
+        listing += format("r{} = {} + {}i\n", k + 2, constants[k].real(), constants[k].imag());
+    for (const Instruction& instruction : program)
+        listing += format("{:<6} r{}, r{}, r{}\n", OpCodeName(instruction.op), instruction.destination, instruction.a, instruction.b);
+    return listing;
+}
+
+#pragma endregion
+
+#pragma region Interpreter
+
+namespace
+{
+    // Register file laid out as one array of real parts and one of imaginary parts per register
+    struct RegisterFile
+    {
+        vector<float64> re, im;
+
+        RegisterFile(int32 count) : re((size_t)count * Formula::TileSize), im((size_t)count * Formula::TileSize) {}
+
+        float64* Re(uint8 r) { return &re[(size_t)r * Formula::TileSize]; }
+        float64* Im(uint8 r) { return &im[(size_t)r * Formula::TileSize]; }
+    };
+
+    // Runs the program once over every lane of the tile
+    void Execute(const vector<Formula::Instruction>& program, RegisterFile& registers)
+    {
+        constexpr int32 N = Formula::TileSize;
+        for (const Formula::Instruction& instruction : program)
+        {
+            float64* dr = registers.Re(instruction.destination);
+            float64* di = registers.Im(instruction.destination);
+            const float64* ar = registers.Re(instruction.a);
+            const float64* ai = registers.Im(instruction.a);
+            const float64* br = registers.Re(instruction.b);
+            const float64* bi = registers.Im(instruction.b);
+
+            switch (instruction.op)
+            {
+                case Formula::OpCode::Copy:
+                    for (int32 k = 0; k < N; k++) { dr[k] = ar[k]; di[k] = ai[k]; }
+                    break;
+                case Formula::OpCode::Add:
+                    for (int32 k = 0; k < N; k++) { dr[k] = ar[k] + br[k]; di[k] = ai[k] + bi[k]; }
+                    break;
+                case Formula::OpCode::Sub:
+                    for (int32 k = 0; k < N; k++) { dr[k] = ar[k] - br[k]; di[k] = ai[k] - bi[k]; }
+                    break;
+                case Formula::OpCode::Mul:
+                    for (int32 k = 0; k < N; k++)
+                    {
+                        float64 re = ar[k] * br[k] - ai[k] * bi[k];
+                        float64 im = ar[k] * bi[k] + ai[k] * br[k];
+                        dr[k] = re; di[k] = im;
+                    }
+                    break;
+                case Formula::OpCode::Div:
+                    for (int32 k = 0; k < N; k++)
+                    {
+                        float64 d = br[k] * br[k] + bi[k] * bi[k];
+                        float64 re = (ar[k] * br[k] + ai[k] * bi[k]) / d;
+                        float64 im = (ai[k] * br[k] - ar[k] * bi[k]) / d;
+                        dr[k] = re; di[k] = im;
+                    }
+                    break;
+                case Formula::OpCode::Neg:
+                    for (int32 k = 0; k < N; k++) { dr[k] = -ar[k]; di[k] = -ai[k]; }
+                    break;
+                case Formula::OpCode::Square:
+                    for (int32 k = 0; k < N; k++)
+                    {
+                        float64 re = ar[k] * ar[k] - ai[k] * ai[k];
+                        float64 im = 2 * ar[k] * ai[k];
+                        dr[k] = re; di[k] = im;
+                    }
+                    break;
+                case Formula::OpCode::Conj:
+                    for (int32 k = 0; k < N; k++) { dr[k] = ar[k]; di[k] = -ai[k]; }
+                    break;
+                case Formula::OpCode::Abs:
+                    for (int32 k = 0; k < N; k++) { dr[k] = sqrt(ar[k] * ar[k] + ai[k] * ai[k]); di[k] = 0; }
+                    break;
+                case Formula::OpCode::Sqrt:
+                    for (int32 k = 0; k < N; k++)
+                    {
+                        float64 magnitude = sqrt(ar[k] * ar[k] + ai[k] * ai[k]);
+                        float64 re = sqrt((magnitude + ar[k]) * 0.5);
+                        float64 im = copysign(sqrt((magnitude - ar[k]) * 0.5), ai[k]);
+                        dr[k] = re; di[k] = im;
+                    }
+                    break;
+                case Formula::OpCode::Exp:
+                    for (int32 k = 0; k < N; k++)
+                    {
+                        float64 magnitude = exp(ar[k]);
+                        float64 im = ai[k];
+                        dr[k] = magnitude * cos(im); di[k] = magnitude * sin(im);
+                    }
+                    break;
+                case Formula::OpCode::Log:
+                    for (int32 k = 0; k < N; k++)
+                    {
+                        float64 re = 0.5 * log(ar[k] * ar[k] + ai[k] * ai[k]);
+                        float64 im = atan2(ai[k], ar[k]);
+                        dr[k] = re; di[k] = im;
+                    }
+                    break;
+                case Formula::OpCode::Sin:
+                    for (int32 k = 0; k < N; k++)
+                    {
+                        float64 re = sin(ar[k]) * cosh(ai[k]);
+                        float64 im = cos(ar[k]) * sinh(ai[k]);
+                        dr[k] = re; di[k] = im;
+                    }
+                    break;
+                case Formula::OpCode::Cos:
+                    for (int32 k = 0; k < N; k++)
+                    {
+                        float64 re = cos(ar[k]) * cosh(ai[k]);
+                        float64 im = -sin(ar[k]) * sinh(ai[k]);
+                        dr[k] = re; di[k] = im;
+                    }
+                    break;
+                case Formula::OpCode::Sinh:
+                    for (int32 k = 0; k < N; k++)
+                    {
+                        float64 re = sinh(ar[k]) * cos(ai[k]);
+                        float64 im = cosh(ar[k]) * sin(ai[k]);
+                        dr[k] = re; di[k] = im;
+                    }
+                    break;
+                case Formula::OpCode::Cosh:
+                    for (int32 k = 0; k < N; k++)
+                    {
+                        float64 re = cosh(ar[k]) * cos(ai[k]);
+                        float64 im = sinh(ar[k]) * sin(ai[k]);
+                        dr[k] = re; di[k] = im;
+                    }
+                    break;
+            }
+        }
+    }
+}
+
+void Formula::RenderRow(const Viewport& viewport, int32 row, bool pixelIsC, const FormulaParams& params, float64 radius, int32 iterationDepth, float64* out) const
+{
+    constexpr int32 N = TileSize;
+    RegisterFile registers(registerCount);
+    for (size_t k = 0; k < constants.size(); k++)
+    {
+        for (int32 lane = 0; lane < N; lane++)
+        {
+            registers.Re((uint8)(2 + k))[lane] = constants[k].real();
+            registers.Im((uint8)(2 + k))[lane] = constants[k].imag();
+        }
+    }
+
+    float64* zr = registers.Re(RegisterZ);
+    float64* zi = registers.Im(RegisterZ);
+    float64* cr = registers.Re(RegisterC);
+    float64* ci = registers.Im(RegisterC);
+
+    // Each lane works through the row, taking the next pixel as soon as its current one is done,
+    // so lanes never sit idle waiting for slower neighbours
+    int32 pixel[N];
+    int32 iteration[N];
+    int32 nextPixel = 0;
+    int32 busyLanes = 0;
+    float64 y = viewport.Y(row);
+
+    auto refill = [&](int32 lane)
+    {
+        while (nextPixel < viewport.width)
+        {
+            int32 i = nextPixel++;
+            float64 x = viewport.X(i);
+            zr[lane] = x;
+            zi[lane] = y;
+            cr[lane] = pixelIsC ? x : params.cx;
+            ci[lane] = pixelIsC ? y : params.cy;
+
+            // Points that start outside the radius escape before the first iteration
+            float64 magnitude = x * x + y * y;
+            if (magnitude >= radius)
+            {
+                out[i] = SmoothIteration(0, magnitude, smoothingExponent);
+                continue;
+            }
+            pixel[lane] = i;
+            iteration[lane] = 0;
+            return true;
+        }
+
+        // Park the lane on a harmless value
+        pixel[lane] = -1;
+        zr[lane] = zi[lane] = cr[lane] = ci[lane] = 0;
+        return false;
+    };
+
+    for (int32 lane = 0; lane < N; lane++)
+        busyLanes += refill(lane);
+
+    while (busyLanes > 0)
+    {
+        Execute(program, registers);
+
+        for (int32 lane = 0; lane < N; lane++)
+        {
+            if (pixel[lane] < 0)
+                continue;
+
+            iteration[lane]++;
+            float64 magnitude = zr[lane] * zr[lane] + zi[lane] * zi[lane];
+            if (iteration[lane] >= iterationDepth)
+                out[pixel[lane]] = -1;
+            else if (!isfinite(magnitude))
+                out[pixel[lane]] = iteration[lane];  // Overflowed in a single step, too far out to smooth
+            else if (magnitude >= radius)
+                out[pixel[lane]] = SmoothIteration(iteration[lane], magnitude, smoothingExponent);
+            else
+                continue;
+
+            busyLanes -= !refill(lane);
+        }
+    }
+}
+
+#pragma endregion
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <complex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+#include "Fractal.h"
+
+// A user-defined escape-time formula, for example "z^3 + c*sin(z)"
+// The source is parsed into an expression tree, optimized and compiled to bytecode for a register machine
+// Every instruction is run over a whole tile of pixels so the cost of dispatching it is shared between them
+class Formula
+{
+public:
+    // Pixels iterated together by one instruction dispatch
+    static constexpr int32 TileSize = 64;
+
+    enum class OpCode : uint8
+    {
+        Copy, Add, Sub, Mul, Div, Neg, Square, Conj, Abs, Sqrt, Exp, Log, Sin, Cos, Sinh, Cosh
+    };
+
+    struct Instruction
+    {
+        OpCode op;
+        uint8 destination;
+        uint8 a;
+        uint8 b;
+    };
+
+    // Registers that hold the iteration state, every other register is a constant or a temporary
+    static constexpr uint8 RegisterZ = 0;
+    static constexpr uint8 RegisterC = 1;
+
+    // Returns nothing and sets error if the source is invalid
+    static std::optional<Formula> Compile(const std::string& source, std::string& error);
+
+    // Computes the smoothed escape time of every pixel in a row, -1 marks pixels that never escaped
+    // pixelIsC chooses between Mandelbrot-style (z0 = c = pixel) and Julia-style (z0 = pixel, c = params) iteration
+    void RenderRow(const Viewport& viewport, int32 row, bool pixelIsC, const FormulaParams& params, float64 radius, int32 iterationDepth, float64* out) const;
+
+    // The power of z in the formula, used by the smoothing formula
+    float64 SmoothingExponent() const { return smoothingExponent; }
+
+    // Human readable listing of the compiled program
+    std::string Disassemble() const;
+
+private:
+    std::vector<Instruction> program;
+    std::vector<std::complex<float64>> constants;  // Loaded into the registers following RegisterC
+    int32 registerCount = 0;
+    float64 smoothingExponent = 2;
+
+    friend class FormulaCompiler;
+};
@@ -0,0 +1,53 @@
+#include "Fractal.h"
+
+template<typename Formula>
+static void RenderRowWithTrap(const Viewport& viewport, int32 row, const FormulaParams& params, const OrbitTrap& trap, float64 radius, int32 iterationDepth, float64* out)
+{
+    switch (trap.type)
+    {
+        case OrbitTrapType::None:
+            RenderRow<Formula, NoTrap>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+        case OrbitTrapType::Point:
+            RenderRow<Formula, PointTrap>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+        case OrbitTrapType::Line:
+            RenderRow<Formula, LineTrap>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+        case OrbitTrapType::Cross:
+            RenderRow<Formula, CrossTrap>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+    }
+}
+
+void RenderRow(FractalType fractalType, const Viewport& viewport, int32 row, const FormulaParams& params, const OrbitTrap& trap, float64 radius, int32 iterationDepth, float64* out)
+{
+    switch (fractalType)
+    {
+        case FractalType::Julia:
+            RenderRowWithTrap<JuliaFormula>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+        case FractalType::Multibrot:
+            RenderRowWithTrap<MultibrotFormula>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+        case FractalType::Mandelbrot:
+            RenderRowWithTrap<MandelbrotFormula>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+        case FractalType::BurningShip:
+            RenderRowWithTrap<BurningShipFormula>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+        case FractalType::Tricorn:
+            RenderRowWithTrap<TricornFormula>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+        case FractalType::Celtic:
+            RenderRowWithTrap<CelticFormula>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+        case FractalType::MultibrotJulia:
+            RenderRowWithTrap<MultibrotJuliaFormula>(viewport, row, params, trap, radius, iterationDepth, out);
+            break;
+        case FractalType::Custom:
+            break;  // Rendered by Formula::RenderRow()
+        case FractalType::Newton:
+            break;  // Rendered by NewtonFractal::RenderRow()
+    }
+}
@@ -0,0 +1,360 @@
+#pragma once
+
+#include <cmath>
+
+#include "Types.h"
+#include "Simd.h"
+
+enum class FractalType
+{
+    Julia, Multibrot, Mandelbrot, BurningShip, Tricorn, Celtic, MultibrotJulia,
+    Custom,  // User-defined formula, see Formula.h
+    Newton   // Newton's method on a polynomial, see Newton.h
+};
+
+// Values shared by every formula, each formula only reads the ones it needs
+struct FormulaParams
+{
+    float64 cx = 0;        // Julia constant (Julia-style formulas only)
+    float64 cy = 0;
+    float64 exponent = 2;  // Power of z (Multibrot-style formulas only)
+};
+
+enum class OrbitTrapType
+{
+    None, Point, Line, Cross
+};
+
+// Shape that the orbit of every point is measured against, see the trap policies below
+struct OrbitTrap
+{
+    OrbitTrapType type = OrbitTrapType::None;
+    float64 x = 0;           // Centre of Point and Cross traps, a point on Line traps
+    float64 y = 0;
+    float64 directionX = 1;  // Unit direction of Line traps
+    float64 directionY = 0;
+};
+
+// Maps pixel coordinates to the complex plane (normally -2 to 2 with a square output)
+struct Viewport
+{
+    int32 width = 1024;
+    int32 height = 1024;
+    float64 scaleX = 1;
+    float64 scaleY = 1;
+    float64 offsetX = 0;
+    float64 offsetY = 0;
+    bool adjustForAspectRatio = true;
+
+    // Windows of a larger image are width x height pixels of it from (left, top), and map pixels as the whole image does
+    int32 left = 0;
+    int32 top = 0;
+    int32 imageWidth = 0;  // Of the whole image, 0 if it is this one
+    int32 imageHeight = 0;
+
+    float64 X(int32 i) const
+    {
+        float64 fullWidth = imageWidth > 0 ? imageWidth : width;
+        float64 fullHeight = imageHeight > 0 ? imageHeight : height;
+        float64 x = ((float64)(i + left) / fullWidth) * 4 + -2;
+        x /= scaleX;
+        if (adjustForAspectRatio)
+            x *= fullWidth / fullHeight;
+        return x + offsetX;
+    }
+
+    float64 Y(int32 j) const
+    {
+        float64 fullHeight = imageHeight > 0 ? imageHeight : height;
+        float64 y = ((float64)(j + top) / fullHeight) * 4 + -2;
+        y /= scaleY;
+        return y + offsetY;
+    }
+
+    // Viewport of a windowWidth x windowHeight part of this one, whose top left pixel is (windowLeft, windowTop)
+    // Every pixel of the window maps to exactly the same point as in this one, so a large image can be rendered in tiles
+    Viewport Window(int32 windowLeft, int32 windowTop, int32 windowWidth, int32 windowHeight) const
+    {
+        Viewport window = *this;
+        window.width = windowWidth;
+        window.height = windowHeight;
+        window.left = left + windowLeft;
+        window.top = top + windowTop;
+        window.imageWidth = imageWidth > 0 ? imageWidth : width;
+        window.imageHeight = imageHeight > 0 ? imageHeight : height;
+        return window;
+    }
+};
+
+#pragma region Formulas
+
+// A formula is a policy for EscapeTime():
+//   PixelIsC            - true for Mandelbrot-style sets (z0 = c = pixel), false for Julia-style sets (z0 = pixel, c = constant)
+//   SmoothingExponent() - the power of z, used by the smoothing formula
+//   Step()              - one iteration of z, written once for float64 and VecF64
+
+struct JuliaFormula
+{
+    static constexpr bool PixelIsC = false;
+    static float64 SmoothingExponent(const FormulaParams& params) { return 2; }
+
+    template<typename T>
+    static void Step(T& x, T& y, const T& cx, const T& cy, const FormulaParams& params)
+    {
+        T tempX = x * x - y * y;
+        y = 2 * x * y + cy;
+        x = tempX + cx;
+    }
+};
+
+struct MandelbrotFormula
+{
+    static constexpr bool PixelIsC = true;
+    static float64 SmoothingExponent(const FormulaParams& params) { return 2; }
+
+    template<typename T>
+    static void Step(T& x, T& y, const T& cx, const T& cy, const FormulaParams& params)
+    {
+        JuliaFormula::Step(x, y, cx, cy, params);
+    }
+};
+
+// z = z^n + c in polar form, slower than Mandelbrot but works for any exponent
+struct MultibrotFormula
+{
+    static constexpr bool PixelIsC = true;
+
+    // The smoothing formula only holds for powers above 1, other exponents smooth as the baseline did, with 2
+    static float64 SmoothingExponent(const FormulaParams& params) { return params.exponent > 1 ? params.exponent : 2; }
+
+    template<typename T>
+    static void Step(T& x, T& y, const T& cx, const T& cy, const FormulaParams& params)
+    {
+        T magnitude = Pow(x * x + y * y, params.exponent / 2);
+        T angle = params.exponent * Atan2(y, x);
+        x = magnitude * Cos(angle) + cx;
+        y = magnitude * Sin(angle) + cy;
+    }
+};
+
+// Julia set of z = z^n + c
+struct MultibrotJuliaFormula
+{
+    static constexpr bool PixelIsC = false;
+    static float64 SmoothingExponent(const FormulaParams& params) { return MultibrotFormula::SmoothingExponent(params); }
+
+    template<typename T>
+    static void Step(T& x, T& y, const T& cx, const T& cy, const FormulaParams& params)
+    {
+        MultibrotFormula::Step(x, y, cx, cy, params);
+    }
+};
+
+// z = (|Re(z)| + i|Im(z)|)^2 + c
+struct BurningShipFormula
+{
+    static constexpr bool PixelIsC = true;
+    static float64 SmoothingExponent(const FormulaParams& params) { return 2; }
+
+    template<typename T>
+    static void Step(T& x, T& y, const T& cx, const T& cy, const FormulaParams& params)
+    {
+        T tempX = x * x - y * y;
+        y = 2 * Abs(x * y) + cy;
+        x = tempX + cx;
+    }
+};
+
+// z = conj(z)^2 + c
+struct TricornFormula
+{
+    static constexpr bool PixelIsC = true;
+    static float64 SmoothingExponent(const FormulaParams& params) { return 2; }
+
+    template<typename T>
+    static void Step(T& x, T& y, const T& cx, const T& cy, const FormulaParams& params)
+    {
+        T tempX = x * x - y * y;
+        y = -2 * x * y + cy;
+        x = tempX + cx;
+    }
+};
+
+// Mandelbrot with the absolute value of the real part of z^2
+struct CelticFormula
+{
+    static constexpr bool PixelIsC = true;
+    static float64 SmoothingExponent(const FormulaParams& params) { return 2; }
+
+    template<typename T>
+    static void Step(T& x, T& y, const T& cx, const T& cy, const FormulaParams& params)
+    {
+        T tempX = Abs(x * x - y * y);
+        y = 2 * x * y + cy;
+        x = tempX + cx;
+    }
+};
+
+#pragma endregion
+
+#pragma region Orbit Traps
+
+// A trap is a policy for EscapeTime() that measures the squared distance from z to the trap
+// The smallest distance over the orbit is accumulated inside the iteration loop, so no orbit is ever stored
+
+struct NoTrap
+{
+    static constexpr bool Enabled = false;
+
+    template<typename T>
+    static T Distance(const T& x, const T& y, const OrbitTrap& trap) { return 0; }
+};
+
+struct PointTrap
+{
+    static constexpr bool Enabled = true;
+
+    template<typename T>
+    static T Distance(const T& x, const T& y, const OrbitTrap& trap)
+    {
+        T dx = x - trap.x;
+        T dy = y - trap.y;
+        return dx * dx + dy * dy;
+    }
+};
+
+struct LineTrap
+{
+    static constexpr bool Enabled = true;
+
+    template<typename T>
+    static T Distance(const T& x, const T& y, const OrbitTrap& trap)
+    {
+        T d = (x - trap.x) * trap.directionY - (y - trap.y) * trap.directionX;
+        return d * d;
+    }
+};
+
+// Horizontal and vertical lines through the trap point
+struct CrossTrap
+{
+    static constexpr bool Enabled = true;
+
+    template<typename T>
+    static T Distance(const T& x, const T& y, const OrbitTrap& trap)
+    {
+        T d = Min(Abs(x - trap.x), Abs(y - trap.y));
+        return d * d;
+    }
+};
+
+#pragma endregion
+
+#pragma region Escape Time
+
+// Smoothing formula, z is the squared magnitude at the point of escape
+// Written so NaN, from a negative power landing on z = 0, clamps to 0 as well, the point escaped either way
+inline float64 SmoothIteration(int32 iteration, float64 z, float64 exponent)
+{
+    float64 ret = iteration + 1 - log(log(z)) / log(exponent);
+    return ret > 0 ? ret : 0;
+}
+
+// Returns the smoothed iteration count at which the point escaped, or -1 if it never escaped
+// With a trap, returns the closest distance between the orbit and the trap instead
+template<typename Formula, typename Trap = NoTrap>
+float64 EscapeTime(float64 x, float64 y, const FormulaParams& params, const OrbitTrap& trap, float64 radius, int32 iterationDepth)
+{
+    float64 cx = Formula::PixelIsC ? x : params.cx;
+    float64 cy = Formula::PixelIsC ? y : params.cy;
+    float64 trapDistance = Trap::Distance(x, y, trap);
+    int32 iteration = 0;
+
+    while (x * x + y * y < radius)
+    {
+        Formula::Step(x, y, cx, cy, params);
+        iteration++;
+        if constexpr (Trap::Enabled)
+            trapDistance = Min(trapDistance, Trap::Distance(x, y, trap));
+
+        // If the point never escaped
+        if (iteration >= iterationDepth)
+            return Trap::Enabled ? sqrt(trapDistance) : -1;
+    }
+
+    if constexpr (Trap::Enabled)
+        return sqrt(trapDistance);
+    return SmoothIteration(iteration, x * x + y * y, Formula::SmoothingExponent(params));
+}
+
+// Iterates LaneCount points at once, lanes that have escaped are frozen until every lane is done
+template<typename Formula, typename Trap = NoTrap>
+void EscapeTime(const VecF64& x0, const VecF64& y0, const FormulaParams& params, const OrbitTrap& trap, float64 radius, int32 iterationDepth, float64* out)
+{
+    VecF64 x = x0;
+    VecF64 y = y0;
+    VecF64 cx = Formula::PixelIsC ? x0 : VecF64(params.cx);
+    VecF64 cy = Formula::PixelIsC ? y0 : VecF64(params.cy);
+    VecF64 trapDistance = Trap::Distance(x, y, trap);
+    VecF64 escapedAt = 0;
+    VecMask active = x * x + y * y < radius;
+    int32 iteration = 0;
+
+    while (Any(active))
+    {
+        VecF64 nextX = x;
+        VecF64 nextY = y;
+        Formula::Step(nextX, nextY, cx, cy, params);
+        x = Select(active, nextX, x);
+        y = Select(active, nextY, y);
+        iteration++;
+
+        // Frozen lanes only measure their final point again, so no mask is needed
+        if constexpr (Trap::Enabled)
+            trapDistance = Min(trapDistance, Trap::Distance(x, y, trap));
+
+        // Lanes still active here never escaped
+        if (iteration >= iterationDepth)
+            break;
+
+        VecMask inside = x * x + y * y < radius;
+        escapedAt = Select(active & ~inside, VecF64(iteration), escapedAt);
+        active = active & inside;
+    }
+
+    if constexpr (Trap::Enabled)
+    {
+        for (int32 k = 0; k < LaneCount; k++)
+            out[k] = sqrt(trapDistance[k]);
+        return;
+    }
+
+    float64 exponent = Formula::SmoothingExponent(params);
+    for (int32 k = 0; k < LaneCount; k++)
+        out[k] = active.m[k] ? -1 : SmoothIteration((int32)escapedAt[k], x[k] * x[k] + y[k] * y[k], exponent);
+}
+
+// Computes a row of pixels with the vectorized kernel, the remainder of the row uses the scalar kernel
+template<typename Formula, typename Trap = NoTrap>
+void RenderRow(const Viewport& viewport, int32 row, const FormulaParams& params, const OrbitTrap& trap, float64 radius, int32 iterationDepth, float64* out)
+{
+    float64 y = viewport.Y(row);
+    int32 i = 0;
+
+    for (; i + LaneCount <= viewport.width; i += LaneCount)
+    {
+        VecF64 x;
+        for (int32 k = 0; k < LaneCount; k++)
+            x[k] = viewport.X(i + k);
+        EscapeTime<Formula, Trap>(x, VecF64(y), params, trap, radius, iterationDepth, out + i);
+    }
+
+    for (; i < viewport.width; i++)
+        out[i] = EscapeTime<Formula, Trap>(viewport.X(i), y, params, trap, radius, iterationDepth);
+}
+
+#pragma endregion
+
+// Computes the smoothed escape time of every pixel in a row, -1 marks pixels that never escaped
+// With an orbit trap, computes the closest distance between each pixel's orbit and the trap instead
+void RenderRow(FractalType fractalType, const Viewport& viewport, int32 row, const FormulaParams& params, const OrbitTrap& trap, float64 radius, int32 iterationDepth, float64* out);
@@ -5,117 +5,61 @@
 #include <filesystem>
 #include <format>
 #include <chrono>
+#include <array>
+#include <complex>
+#include <optional>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 
 #include <lodepng.h>
 #include <yaml-cpp/yaml.h>
 
-typedef float float32;
-typedef double float64;
-
-typedef int8_t int8;
-typedef int16_t int16;
-typedef int32_t int32;
-typedef int64_t int64;
-
-typedef uint8_t uint8;
-typedef uint16_t uint16;
-typedef uint32_t uint32;
-typedef uint64_t uint64;
+#include "Types.h"
+#include "Fractal.h"
+#include "Formula.h"
+#include "Newton.h"
+#include "Field.h"
+#include "Colour.h"
+#include "Parallel.h"
+#include "Encoder.h"
+#include "PngWriter.h"
+#include "QoiWriter.h"
+#include "ApngWriter.h"
+#include "FloatImage.h"
+#include "Y4mWriter.h"
+#include "TilePyramid.h"
+#include "TiffWriter.h"
+#include "AsyncWriter.h"
 
 using namespace std;
 
 YAML::Node Config;
 
-enum class FractalType
-{
-    Julia, Multibrot, Mandelbrot
-};
-
-float64 Julia(float64 x, float64 y, float64 cx, float64 cy, float64 radius, int32 iterationDepth)
-{
-    int32 iteration = 0;
-
-    while (x * x + y * y < radius)
-    {
-        float64 tempX = x * x - y * y;
-        y = 2 * x * y + cy;
-        x = tempX + cx;
-        iteration++;
-
-        // If the point never escaped
-        if (iteration >= iterationDepth)
-            return -1;
-    }
-
-    // Smoothing formula
-    float64 z = x * x + y * y;
-    float64 ret = iteration + 1 - log(log(z)) / log(2);
+// Images with more bytes of pixels than this are streamed to the file, as lodepng needs them in memory twice
+constexpr uint64 StreamingThreshold = (uint64)1 << 31;
 
-    return ret < 0 ? 0 : ret;
-}
-
-double Multibrot(long double x, long double y, double n, double radius, int iterationDepth)
-{
-    //if (n == 2) return Mandelbrot(x, y, radius, iterationDepth);  // we can call the more efficient function if exponent is 2
-    int iteration = 0;
-    double cx = x;
-    double cy = y;
-
-    while (x * x + y * y < radius)
-    {
-        double tempX = pow((x * x + y * y), n / 2) * cos(n * atan2(y, x)) + cx;
-        y = pow((x * x + y * y), n / 2) * sin(n * atan2(y, x)) + cy;
-        x = tempX;
-        iteration++;
-
-        // If the point never escaped
-        if (iteration >= iterationDepth)
-            return -1;
-    }
-
-    // Smoothing formula
-    double z = x * x + y * y;
-    double ret = iteration + 1 - log(log(z)) / log(2);
-
-    return ret < 0 ? 0 : ret;
-}
-
-double Mandelbrot(long double x, long double y, double radius, int iterationDepth)
+template<typename T>
+T GetConfigValue(const YAML::Node& node, const string& key, T defaultValue)
 {
-    double cx = x;
-    double cy = y;
-    int iteration = 0;
-
-    while (x * x + y * y < radius)
-    {
-        double tempX = pow(x,2) - pow(y,2) + cx;
-        y = 2 * x * y + cy;
-        x = tempX;
-        iteration++;
-
-        // If the point never escaped
-        if (iteration >= iterationDepth)
-            return -1;
-    }
-
-    double z = x * x + y * y;
-    double ret = iteration + 1 - log(log(z)) / log(2);
-
-    return ret < 0 ? 0 : ret;
+    return node[key] ? node[key].as<T>() : defaultValue;
 }
 
 template<typename T>
 T GetConfigValue(const string& key, T defaultValue)
 {
-    return Config[key] ? Config[key].as<T>() : defaultValue;
+    return GetConfigValue(Config, key, defaultValue);
 }
 
+// Where logs and progress go, stderr when stdout carries the frames
+ostream* LogOutput = &cout;
+
 void Log(string message, bool error = false)
 {
     if (error)
-        cout << "Error: ";
+        *LogOutput << "Error: ";
 
-    cout << message << endl;
+    *LogOutput << message << endl;
 }
 
 float64 Interpolate(float64 start, float64 end,float64 pos, string method = "linear") {
@@ -135,6 +79,26 @@ int32 main()
     }
 
     Config = YAML::LoadFile("config.yml");
+    if (GetConfigValue("Format", (string)"png") == "y4m" && GetConfigValue("VideoPath", (string)"-") == "-")
+        LogOutput = &cerr;
+
+    // Resuming continues an interrupted render in its saved field, using the parameters it was started with
+    IterationField field;
+    YAML::Node render;
+    string resume = GetConfigValue("Resume", (string)"");
+    int32 resumeRow = 0;
+    if (!resume.empty())
+    {
+        string fieldError;
+        if (!field.Open(resume, true, render, resumeRow, fieldError))
+        {
+            Log(format("Fatal Error: Failed to load field: {}", fieldError), true);
+            return -4;
+        }
+        for (const auto& entry : render)
+            Config[entry.first.as<string>()] = entry.second;
+        Log(format("Resuming '{}' from row {} of {}", resume, resumeRow, field.height));
+    }
 
 #pragma region Parameters
 
@@ -147,6 +111,18 @@ int32 main()
         fractalType = FractalType::Multibrot;
     else if (fractalTypeString == "Mandelbrot")
         fractalType = FractalType::Mandelbrot;
+    else if (fractalTypeString == "BurningShip")
+        fractalType = FractalType::BurningShip;
+    else if (fractalTypeString == "Tricorn")
+        fractalType = FractalType::Tricorn;
+    else if (fractalTypeString == "Celtic")
+        fractalType = FractalType::Celtic;
+    else if (fractalTypeString == "MultibrotJulia")
+        fractalType = FractalType::MultibrotJulia;
+    else if (fractalTypeString == "Custom")
+        fractalType = FractalType::Custom;
+    else if (fractalTypeString == "Newton")
+        fractalType = FractalType::Newton;
     else
     {
         Log(format("Fatal Error: FractalType '{}' is invalid", fractalTypeString), true);
@@ -158,19 +134,124 @@ int32 main()
 
     float64 MultibrotExponent = GetConfigValue("MultibrotExponent", 2.0);
 
+    // Custom formula, compiled once and reused for every frame
+    optional<Formula> formula;
+    bool formulaPixelIsC = false;
+    if (fractalType == FractalType::Custom)
+    {
+        string formulaError;
+        formula = Formula::Compile(GetConfigValue("Formula", (string)"z^2 + c"), formulaError);
+        if (!formula)
+        {
+            Log(format("Fatal Error: Formula is invalid: {}", formulaError), true);
+            return -2;
+        }
+
+        string formulaStart = GetConfigValue("FormulaStart", (string)"Julia");
+        if (formulaStart == "Mandelbrot")
+            formulaPixelIsC = true;
+        else if (formulaStart != "Julia")
+        {
+            Log(format("Fatal Error: FormulaStart '{}' is invalid", formulaStart), true);
+            return -2;
+        }
+
+        Log(format("Compiled formula:\n{}", formula->Disassemble()));
+    }
+
+    // Newton fractal, the polynomial's roots are found once and shared by every frame
+    optional<NewtonFractal> newton;
+    float64 newtonTolerance = GetConfigValue("NewtonTolerance", 1e-6);
+    if (fractalType == FractalType::Newton)
+    {
+        // Coefficients are either real numbers or [real, imaginary] pairs
+        vector<complex<float64>> coefficients = { 1, 0, 0, -1 };
+        if (Config["NewtonCoefficients"])
+        {
+            coefficients.clear();
+            for (const YAML::Node& coefficient : Config["NewtonCoefficients"])
+            {
+                if (coefficient.IsSequence())
+                    coefficients.emplace_back(coefficient[0].as<float64>(), coefficient[1].as<float64>());
+                else
+                    coefficients.emplace_back(coefficient.as<float64>());
+            }
+        }
+
+        string newtonError;
+        newton = NewtonFractal::Create(coefficients, newtonError);
+        if (!newton)
+        {
+            Log(format("Fatal Error: NewtonCoefficients are invalid: {}", newtonError), true);
+            return -2;
+        }
+        if (newtonTolerance <= 0 || newtonTolerance >= 1)
+        {
+            Log("Fatal Error: NewtonTolerance must be between 0 and 1", true);
+            return -2;
+        }
+
+        for (size_t k = 0; k < newton->Roots().size(); k++)
+            Log(format("Root {}: {:.5f} + {:.5f}i", k + 1, newton->Roots()[k].real(), newton->Roots()[k].imag()));
+    }
+
     // === Image Parameters === //
     int32 width = GetConfigValue("Width", 1024);
     int32 height = GetConfigValue("Height", 1024);
 
-    float64 falloffStrength = GetConfigValue("FalloffStrength", 15.0);
-    float64 falloffR = GetConfigValue("FalloffR", 1.0);
-    float64 falloffG = GetConfigValue("FalloffG", 1.0);
-    float64 falloffB = GetConfigValue("FalloffB", 1.0);
+    ColourParams colours;
+    string colourModeString = GetConfigValue("ColourMode", (string)"Falloff");
+    if (colourModeString == "Falloff")
+        colours.mode = ColourMode::Falloff;
+    else if (colourModeString == "Histogram")
+        colours.mode = ColourMode::Histogram;
+    else
+    {
+        Log(format("Fatal Error: ColourMode '{}' is invalid", colourModeString), true);
+        return -2;
+    }
+    colours.histogramSmoothing = GetConfigValue("HistogramSmoothing", 0.0);
+    if (colours.histogramSmoothing < 0 || colours.histogramSmoothing >= 1)
+    {
+        Log("Fatal Error: HistogramSmoothing must be at least 0 and less than 1", true);
+        return -2;
+    }
+
+    colours.falloffStrength = GetConfigValue("FalloffStrength", 15.0);
+    colours.falloffR = GetConfigValue("FalloffR", 1.0);
+    colours.falloffG = GetConfigValue("FalloffG", 1.0);
+    colours.falloffB = GetConfigValue("FalloffB", 1.0);
 
-    float64 backgroundR = GetConfigValue("BackgroundR", 0.0);
-    float64 backgroundG = GetConfigValue("BackgroundG", 0.0);
-    float64 backgroundB = GetConfigValue("BackgroundB", 0.0);
-    float64 backgroundA = GetConfigValue("BackgroundA", 1.0);
+    colours.backgroundR = GetConfigValue("BackgroundR", 0.0);
+    colours.backgroundG = GetConfigValue("BackgroundG", 0.0);
+    colours.backgroundB = GetConfigValue("BackgroundB", 0.0);
+    colours.backgroundA = GetConfigValue("BackgroundA", 1.0);
+
+    // Each stop is [position, r, g, b] or [position, r, g, b, a], in order of position
+    if (Config["Palette"])
+    {
+        for (const YAML::Node& stop : Config["Palette"])
+        {
+            if (!stop.IsSequence() || (stop.size() != 4 && stop.size() != 5))
+            {
+                Log("Fatal Error: Palette stops must be [position, r, g, b] or [position, r, g, b, a]", true);
+                return -2;
+            }
+            colours.palette.push_back({ stop[0].as<float64>(), stop[1].as<float64>(), stop[2].as<float64>(), stop[3].as<float64>(), stop.size() == 5 ? stop[4].as<float64>() : 1.0 });
+            if (colours.palette.back().position < 0 || colours.palette.back().position > 1 || (colours.palette.size() > 1 && colours.palette.back().position < colours.palette[colours.palette.size() - 2].position))
+            {
+                Log("Fatal Error: Palette stop positions must be between 0 and 1 and in increasing order", true);
+                return -2;
+            }
+        }
+        if (colours.palette.size() < 2)
+        {
+            Log("Fatal Error: Palette needs at least 2 stops", true);
+            return -2;
+        }
+    }
+
+    colours.newtonColours = GetConfigValue("NewtonColours", vector<array<float64, 3>>());
 
     filesystem::path outputPath = filesystem::path(GetConfigValue("OutputPath", filesystem::current_path().string()));
 
@@ -182,10 +263,39 @@ int32 main()
     float64 scaleY = GetConfigValue("ScaleY", 1.0);
 
     // === Calculation Parameters === //
-    float64 nonEscapingValue = GetConfigValue("NonEscapingValue", 0.0);
+    colours.nonEscapingValue = GetConfigValue("NonEscapingValue", 0.0);
     int32 maxIterations = GetConfigValue("MaxIterations", 1000);
     float64 radius = GetConfigValue("EscapeRadius", 4.0);
 
+    // === Orbit Trap Parameters === //
+    OrbitTrap orbitTrap;
+    string orbitTrapString = GetConfigValue("OrbitTrap", (string)"None");
+    if (orbitTrapString == "None")
+        orbitTrap.type = OrbitTrapType::None;
+    else if (orbitTrapString == "Point")
+        orbitTrap.type = OrbitTrapType::Point;
+    else if (orbitTrapString == "Line")
+        orbitTrap.type = OrbitTrapType::Line;
+    else if (orbitTrapString == "Cross")
+        orbitTrap.type = OrbitTrapType::Cross;
+    else
+    {
+        Log(format("Fatal Error: OrbitTrap '{}' is invalid", orbitTrapString), true);
+        return -2;
+    }
+    if (orbitTrap.type != OrbitTrapType::None && (fractalType == FractalType::Custom || fractalType == FractalType::Newton))
+    {
+        Log(format("Fatal Error: OrbitTrap is not supported by FractalType '{}'", fractalTypeString), true);
+        return -2;
+    }
+
+    orbitTrap.x = GetConfigValue("OrbitTrapX", 0.0);
+    orbitTrap.y = GetConfigValue("OrbitTrapY", 0.0);
+    float64 orbitTrapAngle = GetConfigValue("OrbitTrapAngle", 0.0) * M_PI / 180;
+    orbitTrap.directionX = cos(orbitTrapAngle);
+    orbitTrap.directionY = sin(orbitTrapAngle);
+    colours.orbitTrapFalloff = GetConfigValue("OrbitTrapFalloff", 0.05);
+
     // === Animation Parameters === //
     bool animate = GetConfigValue("Animate", false);
     int32 frameCount = GetConfigValue("FrameCount", 30);
@@ -204,96 +314,782 @@ int32 main()
     float64 scaleStartY = GetConfigValue("ScaleStartY", 1.0);
     float64 scaleEndY = GetConfigValue("ScaleEndY", 1.0);
 
+    // === Output Parameters === //
+    // Saving the iteration field lets the frame be recoloured later without computing it again
+    bool saveField = GetConfigValue("SaveField", false);
+    string recolor = GetConfigValue("Recolor", (string)"");
+
+    OutputFormat outputFormat;
+    string outputFormatString = GetConfigValue("Format", (string)"png");
+    if (outputFormatString == "png")       outputFormat = OutputFormat::Png;
+    else if (outputFormatString == "apng") outputFormat = OutputFormat::Apng;
+    else if (outputFormatString == "qoi")  outputFormat = OutputFormat::Qoi;
+    else if (outputFormatString == "y4m")  outputFormat = OutputFormat::Y4m;
+    else if (outputFormatString == "pfm")  outputFormat = OutputFormat::Pfm;
+    else if (outputFormatString == "exr")  outputFormat = OutputFormat::Exr;
+    else if (outputFormatString == "tiff") outputFormat = OutputFormat::Tiff;
+    else
+    {
+        Log(format("Fatal Error: Format '{}' is invalid", outputFormatString), true);
+        return -2;
+    }
+
+    // y4m frames all go to one stream, "-" being stdout
+    string videoPath = GetConfigValue("VideoPath", (string)"-");
+    int32 frameRate = GetConfigValue("FrameRate", 30);
+    if (frameRate <= 0 || frameRate > 65535)
+    {
+        Log("Fatal Error: FrameRate must be between 1 and 65535", true);
+        return -2;
+    }
+    int32 loops = GetConfigValue("Loops", 0);
+    if (loops < 0)
+    {
+        Log("Fatal Error: Loops can't be negative", true);
+        return -2;
+    }
+
+    // A tile pyramid is written instead of a single image, for renders too large to view or hold in memory at once
+    TileLayout tileLayout;
+    string tileLayoutString = GetConfigValue("Tiles", (string)"None");
+    if (tileLayoutString == "None")           tileLayout = TileLayout::None;
+    else if (tileLayoutString == "DeepZoom")  tileLayout = TileLayout::DeepZoom;
+    else if (tileLayoutString == "Xyz")       tileLayout = TileLayout::Xyz;
+    else
+    {
+        Log(format("Fatal Error: Tiles '{}' is invalid", tileLayoutString), true);
+        return -2;
+    }
+    int32 tileSize = GetConfigValue("TileSize", 256);
+    if (tileSize < 16 || tileSize > 4096)
+    {
+        Log("Fatal Error: TileSize must be between 16 and 4096", true);
+        return -2;
+    }
+    if (outputFormat == OutputFormat::Tiff && tileSize % 16 != 0)
+    {
+        Log("Fatal Error: TileSize must be a multiple of 16 for the tiff Format", true);
+        return -2;
+    }
+
+    // === Encoder Parameters === //
+    YAML::Node encoderConfig = Config["Encoder"];
+    EncoderPreset encoderPreset;
+    string encoderPresetString = GetConfigValue(encoderConfig, "Preset", (string)"Balanced");
+    if (encoderPresetString == "Store")          encoderPreset = EncoderPreset::Store;
+    else if (encoderPresetString == "Fast")      encoderPreset = EncoderPreset::Fast;
+    else if (encoderPresetString == "Balanced")  encoderPreset = EncoderPreset::Balanced;
+    else if (encoderPresetString == "Max")       encoderPreset = EncoderPreset::Max;
+    else
+    {
+        Log(format("Fatal Error: Encoder Preset '{}' is invalid", encoderPresetString), true);
+        return -2;
+    }
+
+    DeflateBackend deflateBackend;
+    string deflateBackendString = GetConfigValue(encoderConfig, "Backend", (string)"Parallel");
+    if (deflateBackendString == "lodepng")        deflateBackend = DeflateBackend::Lodepng;
+    else if (deflateBackendString == "Parallel")  deflateBackend = DeflateBackend::Parallel;
+    else if (deflateBackendString == "zlib" && PngEncoder::HasZlib())  deflateBackend = DeflateBackend::Zlib;
+    else
+    {
+        Log(format("Fatal Error: Encoder Backend '{}' is invalid or was not built in", deflateBackendString), true);
+        return -2;
+    }
+
+    // Images too large for lodepng to encode in memory are always streamed
+    bool streamOutput = GetConfigValue(encoderConfig, "Streaming", false);
+
+    // Indexed images are coloured straight into one byte per pixel, from 256 colours along the gradient
+    bool indexedOutput = GetConfigValue(encoderConfig, "Indexed", false);
+    bool dither = GetConfigValue(encoderConfig, "Dither", false);
+    if (indexedOutput && outputFormat != OutputFormat::Png && outputFormat != OutputFormat::Apng)
+    {
+        Log("Fatal Error: Encoder Indexed is only supported by the png Format", true);
+        return -2;
+    }
+
+    // 16-bit images keep the steps of the gradient between 8-bit colours
+    int32 bitDepth = GetConfigValue(encoderConfig, "BitDepth", 8);
+    if (bitDepth != 8 && bitDepth != 16)
+    {
+        Log(format("Fatal Error: Encoder BitDepth {} is invalid, it must be 8 or 16", bitDepth), true);
+        return -2;
+    }
+    if (bitDepth == 16 && (outputFormat != OutputFormat::Png || indexedOutput))
+    {
+        Log("Fatal Error: Encoder BitDepth 16 is only supported by the png Format, and not with Indexed", true);
+        return -2;
+    }
+
+    // Tiles are coloured as soon as they are rendered, so nothing can depend on the whole image
+    bool tiff = outputFormat == OutputFormat::Tiff;
+    if ((tileLayout != TileLayout::None || tiff) && (animate || saveField || !recolor.empty() || !resume.empty() || colours.mode == ColourMode::Histogram))
+    {
+        Log("Fatal Error: Tiles and the tiff Format are only supported for single frames, without SaveField, Recolor, Resume or the Histogram ColourMode", true);
+        return -2;
+    }
+    if (tiff && (indexedOutput || bitDepth == 16))
+    {
+        Log("Fatal Error: The tiff Format is only supported at 8 bits, and not with Indexed", true);
+        return -2;
+    }
+    if (tileLayout != TileLayout::None && (outputFormat != OutputFormat::Png || indexedOutput || bitDepth == 16))
+    {
+        Log("Fatal Error: Tiles are only supported by the png Format at 8 bits, and not with Indexed", true);
+        return -2;
+    }
+
+    // Any setting of the preset can be overridden
+    PngEncoder encoder(encoderPreset, deflateBackend);
+    LodePNGEncoderSettings& encoderSettings = encoder.Settings();
+    encoderSettings.zlibsettings.windowsize = GetConfigValue(encoderConfig, "WindowSize", encoderSettings.zlibsettings.windowsize);
+    if (encoderSettings.zlibsettings.windowsize < 256 || encoderSettings.zlibsettings.windowsize > 32768 || (encoderSettings.zlibsettings.windowsize & (encoderSettings.zlibsettings.windowsize - 1)) != 0)
+    {
+        Log("Fatal Error: Encoder WindowSize must be a power of 2 from 256 to 32768", true);
+        return -2;
+    }
+    encoderSettings.zlibsettings.lazymatching = GetConfigValue(encoderConfig, "LazyMatching", encoderSettings.zlibsettings.lazymatching != 0);
+    encoderSettings.zlibsettings.max_chain_length = GetConfigValue(encoderConfig, "MaxChainLength", encoderSettings.zlibsettings.max_chain_length);
+    if (encoderConfig["FilterStrategy"])
+    {
+        string filterStrategyString = encoderConfig["FilterStrategy"].as<string>();
+        if (filterStrategyString == "None")             encoderSettings.filter_strategy = LFS_ZERO;
+        else if (filterStrategyString == "MinSum")      encoderSettings.filter_strategy = LFS_MINSUM;
+        else if (filterStrategyString == "Entropy")     encoderSettings.filter_strategy = LFS_ENTROPY;
+        else if (filterStrategyString == "BruteForce")  encoderSettings.filter_strategy = LFS_BRUTE_FORCE;
+        else
+        {
+            Log(format("Fatal Error: Encoder FilterStrategy '{}' is invalid", filterStrategyString), true);
+            return -2;
+        }
+    }
+    if (encoderConfig["BlockType"])
+    {
+        string blockTypeString = encoderConfig["BlockType"].as<string>();
+        if (blockTypeString == "Stored")        encoderSettings.zlibsettings.btype = 0;
+        else if (blockTypeString == "Fixed")    encoderSettings.zlibsettings.btype = 1;
+        else if (blockTypeString == "Dynamic")  encoderSettings.zlibsettings.btype = 2;
+        else
+        {
+            Log(format("Fatal Error: Encoder BlockType '{}' is invalid", blockTypeString), true);
+            return -2;
+        }
+    }
+
+    // === Performance Parameters === //
+    SetThreadCount(GetConfigValue("Threads", 0));
+
+    // Megabytes a frame may use, frames that would need more are streamed and keep their field a band at a time or in a file
+    int64 memoryBudgetMegabytes = GetConfigValue("MemoryBudget", (int64)0);
+    if (memoryBudgetMegabytes < 0)
+    {
+        Log("Fatal Error: MemoryBudget can't be negative", true);
+        return -2;
+    }
+    uint64 memoryBudget = (uint64)memoryBudgetMegabytes << 20;
+
+    // Whole frames are written in the background while the next one is computed, up to this many at once
+    int32 writeQueueDepth = GetConfigValue("WriteQueueDepth", 4);
+    if (writeQueueDepth < 0 || writeQueueDepth > 64)
+    {
+        Log("Fatal Error: WriteQueueDepth must be between 0 and 64", true);
+        return -2;
+    }
+    WriteBackend writeBackend;
+    string writeBackendString = GetConfigValue("WriteBackend", (string)"io_uring");
+    if (writeBackendString == "io_uring")      writeBackend = WriteBackend::IoUring;
+    else if (writeBackendString == "Threads")  writeBackend = WriteBackend::Threads;
+    else
+    {
+        Log(format("Fatal Error: WriteBackend '{}' is invalid", writeBackendString), true);
+        return -2;
+    }
+
 #pragma endregion
 
+    // Recolouring skips straight to the colouring pass with a saved field, which is mapped rather than read
+    if (!recolor.empty())
+    {
+        string fieldError;
+        int32 rowsCompleted;
+        if (!field.Open(recolor, false, render, rowsCompleted, fieldError))
+        {
+            Log(format("Fatal Error: Failed to load field: {}", fieldError), true);
+            return -4;
+        }
+        width = field.width;
+        height = field.height;
+        animate = false;
+        Log(format("Loaded {}x{} field from '{}'", width, height, recolor));
+        if (rowsCompleted < height)
+            Log(format("Field is incomplete, only {} of {} rows were rendered", rowsCompleted, height), true);
+    }
+
+    // The palettes don't change between frames, so they are built once
+    ColourMap colourMap(colours);
+
+    // Every colour a frame can have, so the encoder picks the colour type from these instead of searching the frame for them
+    // Resumed and recoloured fields already know their kind
+    if (resume.empty() && recolor.empty())
+        field.kind = fractalType == FractalType::Newton ? FieldKind::Newton : orbitTrap.type != OrbitTrapType::None ? FieldKind::OrbitTrap : FieldKind::EscapeTime;
+    vector<uint32> frameColours = colourMap.Colours(field.kind);
+    vector<uint32> indexedPalette = colourMap.IndexedPalette();
+    if (indexedOutput && field.kind == FieldKind::Newton)
+    {
+        Log("Fatal Error: Encoder Indexed is not supported by the Newton fractal type, whose roots each have their own colours", true);
+        return -2;
+    }
+
+    // QOI only marks whether there is an alpha channel, which is known from the colours as well
+    bool qoi = outputFormat == OutputFormat::Qoi;
+    bool y4m = outputFormat == OutputFormat::Y4m;
+    bool apng = outputFormat == OutputFormat::Apng;
+    bool floatOutput = outputFormat == OutputFormat::Pfm || outputFormat == OutputFormat::Exr;
+    string extension = qoi ? "qoi" : y4m ? "y4m" : outputFormat == OutputFormat::Pfm ? "pfm" : outputFormat == OutputFormat::Exr ? "exr" : "png";
+    bool opaque = all_of(frameColours.begin(), frameColours.end(), [](uint32 colour) { return ((const uint8*)&colour)[3] == 255; });
+
+    // Tiled images are rendered a tile at a time, each on one thread into its own field, which is coloured straight away
+    if (tileLayout != TileLayout::None || tiff)
+    {
+        Viewport viewport = { width, height, scaleX, scaleY, offsetX, offsetY, adjustForAspectRatio };
+        FormulaParams params = { real, imaginary, MultibrotExponent };
+        vector<IterationField> tileFields(ThreadCount());
+        vector<vector<float64>> rows(ThreadCount(), vector<float64>(tileSize));
+        atomic<int64> tilesDone = 0;
+        int64 tileCount = 0;
+
+        auto start = chrono::high_resolution_clock::now();
+        auto renderTile = [&](int32 left, int32 top, int32 tileWidth, int32 tileHeight, int32 thread, uint8* rgba)
+        {
+            Viewport window = viewport.Window(left, top, tileWidth, tileHeight);
+            IterationField& tileField = tileFields[thread];
+            tileField.kind = field.kind;
+            tileField.maxIterations = maxIterations;
+            tileField.Allocate(tileWidth, tileHeight);
+            float64* row = rows[thread].data();
+            for (int32 j = 0; j < tileHeight; j++)
+            {
+                if (fractalType == FractalType::Custom)
+                    formula->RenderRow(window, j, formulaPixelIsC, params, radius, maxIterations, row);
+                else if (fractalType == FractalType::Newton)
+                    newton->RenderRow(window, j, newtonTolerance, maxIterations, row, tileField.RootRow(j));
+                else
+                    RenderRow(fractalType, window, j, params, orbitTrap, radius, maxIterations, row);
+
+                float32* values = tileField.Row(j);
+                for (int32 i = 0; i < tileWidth; i++)
+                    values[i] = (float32)row[i];
+            }
+            colourMap.ColourRows(tileField, 0, tileHeight, rgba);
+
+            int64 done = ++tilesDone;
+            if (thread == 0)
+                *LogOutput << "\r                                 \r" << done << " of " << tileCount << " tiles" << flush;
+        };
+
+        // Every tile of a tiff is written as soon as it is compressed, by the thread that rendered it
+        string tileError;
+        if (tiff)
+        {
+            filesystem::path tiffPath = outputPath / format("julia_{}.tif", to_string(time(nullptr)));
+            TiffWriter tiffWriter;
+            if (!tiffWriter.Open(tiffPath, width, height, tileSize, !opaque, encoder, tileError))
+            {
+                Log(format("Failed to save to file '{}': {}", tiffPath.string(), tileError), true);
+                return -3;
+            }
+            tileCount = (int64)tiffWriter.Columns() * tiffWriter.Rows();
+            Log(format("Rendering {} tiles of {}x{} to '{}'...", tileCount, tileSize, tileSize, tiffPath.string()));
+
+            // The threads stop taking tiles once one of them fails
+            vector<vector<uint8>> pixels(ThreadCount());
+            FirstError failure;
+            ParallelFor(tileCount, [&](int64 index, int32 thread)
+            {
+                int32 column = (int32)(index % tiffWriter.Columns());
+                int32 row = (int32)(index / tiffWriter.Columns());
+                int32 tileWidth = min(tileSize, width - column * tileSize);
+                int32 tileHeight = min(tileSize, height - row * tileSize);
+                if (failure.Failed())
+                    return;
+                pixels[thread].resize((size_t)tileWidth * tileHeight * 4);
+                renderTile(column * tileSize, row * tileSize, tileWidth, tileHeight, thread, pixels[thread].data());
+                string writeError;
+                if (!tiffWriter.WriteTile(column, row, pixels[thread].data(), writeError))
+                    failure.Set(writeError);
+            });
+            if (failure.Failed())
+                tileError = failure.Error();
+            if (failure.Failed() || !tiffWriter.Close(tileError))
+            {
+                Log(format("Failed to save to file '{}': {}", tiffPath.string(), tileError), true);
+                return -3;
+            }
+            *LogOutput << "\r                                 \r";
+            Log(format("Saved to file '{}' in {} ({} bytes, {:.1f}% of the raw pixels)\n", tiffPath.string(), duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start), tiffWriter.Size(), (float64)tiffWriter.Size() / ((float64)width * height * 4) * 100));
+            return 0;
+        }
+
+        // Only the missing tiles of a pyramid are rendered
+        TilePyramid pyramid(tileLayout, outputPath / "julia_tiles", width, height, tileSize);
+        tileCount = pyramid.BaseTileCount();
+        Log(format("Rendering {} levels of {}x{} tiles to '{}'...", pyramid.LevelCount(), tileSize, tileSize, (outputPath / "julia_tiles").string()));
+        if (!pyramid.Write(encoder, frameColours, renderTile, tileError))
+        {
+            Log(format("Failed to write the tiles: {}", tileError), true);
+            return -3;
+        }
+        *LogOutput << "\r                                 \r";
+        Log(format("Rendered {} and downsampled {} tiles in {}, the rest were already there", pyramid.TilesRendered(), pyramid.TilesDownsampled(), duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start)));
+        return 0;
+    }
+
+    // Every frame goes into the one stream, nothing is saved next to it unless the fields are
+    Y4mWriter video;
+    string videoError;
+    if (y4m && !video.Open(videoPath, width, height, frameRate, videoError))
+    {
+        Log(format("Failed to open the video stream: {}", videoError), true);
+        return -3;
+    }
+
     if (animate == false) frameCount = 1;
     string timeString = to_string(std::time(nullptr));  // time string for the output folder name if animation is used
-    if (animate) filesystem::create_directory(outputPath.append(format("julia_{}", timeString)));
+
+    // A frame that isn't streamed holds its field, its image and about as much again for the encoded file
+    uint64 fieldBytes = field.kind == FieldKind::Newton ? 5 : 4;
+    uint64 imageBytes = floatOutput ? 16 : indexedOutput ? 1 : bitDepth == 16 ? 8 : 4;
+    uint64 frameBytes = (uint64)width * height * (fieldBytes + imageBytes * 2);
+    bool overBudget = memoryBudget > 0 && frameBytes > memoryBudget;
+
+    // Animated PNG frames are compared whole, and 16-bit and float images are only coloured whole, so they are never streamed
+    if ((apng || floatOutput || bitDepth == 16) && (streamOutput || (uint64)width * height * 4 > StreamingThreshold))
+    {
+        Log("Fatal Error: Encoder Streaming is only supported by the png, qoi and y4m Formats at 8 bits", true);
+        return -2;
+    }
+    if ((apng || floatOutput || bitDepth == 16) && overBudget)
+    {
+        Log(format("Fatal Error: A frame needs about {} MB, over the MemoryBudget, and only the png, qoi and y4m Formats at 8 bits can be streamed to stay within it", frameBytes >> 20), true);
+        return -2;
+    }
+
+    ApngWriter animation;
+    filesystem::path animationPath = outputPath / format("julia_{}.png", timeString);
+    if (apng)
+    {
+        string animationError;
+        bool opened = indexedOutput
+            ? animation.OpenIndexed(animationPath, width, height, frameCount, frameRate, loops, encoder, indexedPalette, animationError)
+            : animation.Open(animationPath, width, height, frameCount, frameRate, loops, encoder, frameColours, animationError);
+        if (!opened)
+        {
+            Log(format("Failed to save to file '{}': {}", animationPath.string(), animationError), true);
+            return -3;
+        }
+    }
+
+    // Streamed images are coloured, filtered and compressed a band of rows at a time by the thread that coloured the band,
+    // while it is in cache, and written as they go, so the image is never all in memory
+    // Unless the colours depend on the whole frame, each band is rendered by the same thread just before, so the frame
+    // is only ever touched once instead of once for each step
+    // QOI and y4m frames are always streamed, as their bands are encoded on their own anyway
+    // PNG frames whose colours depend on the whole frame are only coloured once it is all rendered, and then written
+    // in order through one deflate stream instead
+    bool stream = qoi || y4m || streamOutput || overBudget || (uint64)width * height * 4 > StreamingThreshold;
+
+    // Only frames encoded whole are queued, streamed ones are written as they are encoded, so the writer is only set up
+    // when there are any
+    optional<AsyncWriter> frameWriter;
+    if (writeQueueDepth > 0 && !stream && !apng && !floatOutput)
+        frameWriter.emplace(writeBackend, writeQueueDepth);
+
+    // Frames that all go into one file only need the folder for their fields
+    if (animate && ((!y4m && !apng) || saveField)) filesystem::create_directory(outputPath.append(format("julia_{}", timeString)));
     for (int frame=0;frame<frameCount;frame++)
     {
-        if (animate && animateCoordinates)  // Update coordinates to animated coordinates
+        filesystem::path path = outputPath;
+        if (animate == false) path.append(format("julia_{}.{}", to_string(time(nullptr)), extension)).string();
+        else path.append(format("{}.{}", frame+1, extension));
+
+        bool fuse = stream && recolor.empty() && colours.mode != ColourMode::Histogram;
+
+        // A fused frame only keeps the bands of the field the threads are working on, each in the thread's own field, and
+        // bands are handed out from the top so only a few are ever waiting to be written, so its memory grows with the
+        // width of the image but not its height
+        // Other frames need the whole field before colouring it, so over the MemoryBudget it is kept in a scratch file
+        // next to the image
+        bool bandFields = fuse && !saveField && resume.empty();
+        vector<IterationField> threadFields(bandFields ? ThreadCount() : 0);
+        PngWriter writer;
+        QoiWriter qoiWriter;
+        string writeError;
+        mutex writeErrorMutex;
+        int32 bandRows = PngWriter::CacheBandRows(width);
+        if (y4m)
+            bandRows = max(2, bandRows & ~1);  // Each row of chroma covers two rows of pixels
+        if (bandFields)
+            bandRows = (bandRows + 7) & ~7;  // Rows of a band field start at 0, so bands keep the rows of the dither pattern
+        int32 bandCount = (height + bandRows - 1) / bandRows;
+        vector<vector<uint8>> bands(stream && (fuse || qoi || y4m) ? ThreadCount() : 0, vector<uint8>((size_t)width * bandRows * 4));
+        auto encodeBand = [&](int32 band, int32 thread)
         {
-            real = Interpolate(realStart, realEnd, (float64)frame/(frameCount-1), interpolationType);
-            imaginary = Interpolate(imaginaryStart, imaginaryEnd, (float64)frame/(frameCount-1), interpolationType);
+            int32 firstRow = band * bandRows;
+            int32 rowCount = min(bandRows, height - firstRow);
+            const IterationField& source = bandFields ? threadFields[thread] : field;
+            int32 sourceRow = bandFields ? 0 : firstRow;
+            if (indexedOutput)
+                colourMap.IndexRows(source, sourceRow, rowCount, dither, bands[thread].data());
+            else
+                colourMap.ColourRows(source, sourceRow, rowCount, bands[thread].data());
+            string bandError;
+            bool written = true;
+            if (y4m)
+                video.ConvertRows(firstRow, bands[thread].data(), rowCount);
+            else if (qoi)
+                written = qoiWriter.WriteBand(firstRow, bands[thread].data(), rowCount, bandError);
+            else
+                written = writer.WriteBand(firstRow, bands[thread].data(), rowCount, bandError);
+            if (!written)
+            {
+                lock_guard lock(writeErrorMutex);
+                writeError = bandError;
+            }
+        };
+        bool opened = true;  // The y4m stream was opened once for every frame
+        if (stream && qoi)
+            opened = qoiWriter.Open(path, width, height, opaque, writeError);
+        else if (stream && !y4m)
+        {
+            opened = indexedOutput
+                ? writer.OpenIndexed(path, width, height, encoder, indexedPalette, writeError)
+                : writer.Open(path, width, height, encoder, frameColours, writeError);
         }
-        if (animate && animateScale)  // Update scale to animated scale
+        if (!opened)
         {
-            scaleX = Interpolate(scaleStartX, scaleEndX, (float64)frame/(frameCount-1), interpolationType);
-            scaleY = Interpolate(scaleStartY, scaleEndY, (float64)frame/(frameCount-1), interpolationType);
+            Log(format("Failed to save to file '{}': {}", path.string(), writeError), true);
+            return -3;
         }
-        // Compute the julia fractal for each pixel in frame
-        Log(format("Computing frame {} of {} ({}.png)...", frame+1, frameCount, frame+1));
-        if (fractalType == FractalType::Julia)           Log(format("Real: {:.5f}, Imaginary: {:.5f}", real, imaginary));
-        else if (fractalType == FractalType::Multibrot)  Log(format("Multibrot exponent: {:.5f}", MultibrotExponent));
-        else if (fractalType == FractalType::Mandelbrot) Log(format("Mandelbrot"));
-        vector<uint8> image(width * height * 4);
-
-        auto start = chrono::high_resolution_clock::now();  // start measuring the execution time
-        auto stop = chrono::high_resolution_clock::now();
-        for (int32 i = 0; i < width; i++)
+
+        if (recolor.empty())
         {
-            for (int32 j = 0; j < height; j++)
+            if (animate && animateCoordinates)  // Update coordinates to animated coordinates
             {
-                // Calculate pixel coordinates (normally -2 to 2 with a square output)
-                float64 x = ((float64)i / (float64)width) * 4 + -2;
-                float64 y = ((float64)j / (float64)height) * 4 + -2;
+                real = Interpolate(realStart, realEnd, (float64)frame/(frameCount-1), interpolationType);
+                imaginary = Interpolate(imaginaryStart, imaginaryEnd, (float64)frame/(frameCount-1), interpolationType);
+            }
+            if (animate && animateScale)  // Update scale to animated scale
+            {
+                scaleX = Interpolate(scaleStartX, scaleEndX, (float64)frame/(frameCount-1), interpolationType);
+                scaleY = Interpolate(scaleStartY, scaleEndY, (float64)frame/(frameCount-1), interpolationType);
+            }
+            // Compute the julia fractal for each pixel in frame
+            if (y4m || apng)
+                Log(format("Computing frame {} of {}...", frame+1, frameCount));
+            else
+                Log(format("Computing frame {} of {} ({}.{})...", frame+1, frameCount, frame+1, extension));
+            if (fractalType == FractalType::Julia)                Log(format("Real: {:.5f}, Imaginary: {:.5f}", real, imaginary));
+            else if (fractalType == FractalType::Multibrot)       Log(format("Multibrot exponent: {:.5f}", MultibrotExponent));
+            else if (fractalType == FractalType::MultibrotJulia)  Log(format("Real: {:.5f}, Imaginary: {:.5f}, Multibrot exponent: {:.5f}", real, imaginary, MultibrotExponent));
+            else if (fractalType == FractalType::Newton)          Log(format("Newton, {} roots", newton->Roots().size()));
+            else if (fractalType == FractalType::Custom)          Log(format("Formula: {}", GetConfigValue("Formula", (string)"z^2 + c")));
+            else                                                  Log(fractalTypeString);
 
-                x /= scaleX;
-                y /= scaleY;
+            // A resumed render already has its field
+            if (resume.empty())
+            {
+                field.maxIterations = maxIterations;
 
-                if (adjustForAspectRatio)
-                    x *= (float64)width / (float64)height;
+                // Saved fields are rendered straight into the file, which also lets them be larger than the available RAM
+                if (saveField)
+                {
+                    // Everything needed to render this frame again, with the animated values of this frame
+                    render = YAML::Clone(Config);
+                    render.remove("Resume");
+                    render.remove("Recolor");
+                    render.remove("Threads");
+                    render["Animate"] = false;
+                    render["Real"] = real;
+                    render["Imaginary"] = imaginary;
+                    render["ScaleX"] = scaleX;
+                    render["ScaleY"] = scaleY;
+                    render["OutputPath"] = path.parent_path().string();
 
-                x += offsetX;
-                y += offsetY;
+                    filesystem::path fieldPath = filesystem::path(path).replace_extension(".npy");
+                    string fieldError;
+                    if (!field.Create(fieldPath, width, height, render, fieldError))
+                    {
+                        Log(fieldError, true);
+                        return -3;
+                    }
+                    Log(format("Saving field to file '{}'", fieldPath.string()));
+                }
+                else if (bandFields)
+                {
+                    for (IterationField& threadField : threadFields)
+                    {
+                        threadField.kind = field.kind;
+                        threadField.maxIterations = maxIterations;
+                        threadField.Allocate(width, bandRows);
+                    }
+                }
+                else if (overBudget)
+                {
+                    filesystem::path scratchPath = filesystem::path(path).replace_extension(".scratch.npy");
+                    string fieldError;
+                    if (!field.CreateScratch(scratchPath, width, height, fieldError))
+                    {
+                        Log(fieldError, true);
+                        return -3;
+                    }
+                    Log(format("Keeping the field in '{}' to stay within the MemoryBudget", scratchPath.string()));
+                }
+                else
+                    field.Allocate(width, height);
+            }
+
+            Viewport viewport = { width, height, scaleX, scaleY, offsetX, offsetY, adjustForAspectRatio };
+            FormulaParams params = { real, imaginary, MultibrotExponent };
+            vector<vector<float64>> rows(ThreadCount(), vector<float64>(width));
+            atomic<int32> rowsDone = resumeRow;
+
+            // Saved fields are checkpointed as they render so an interrupted render can be resumed
+            // Only the rows above the first unfinished row count as completed
+            vector<uint8> rowCompleted(height);
+            int32 rowsCompleted = resumeRow;
+            mutex checkpointMutex;
+            auto lastCheckpoint = chrono::steady_clock::now();
+
+            auto start = chrono::high_resolution_clock::now();  // start measuring the execution time
+            auto stop = chrono::high_resolution_clock::now();
+            auto renderRow = [&](int64 j, int32 thread)
+            {
 
-                // Compute for current pixel
-                float64 result;
-                switch (fractalType)
+                // Compute the whole row at once so the vectorized kernels can be used
+                float64* row = rows[thread].data();
+                IterationField& target = bandFields ? threadFields[thread] : field;
+                int32 targetRow = bandFields ? (int32)j % bandRows : (int32)j;
+                if (fractalType == FractalType::Custom)
+                    formula->RenderRow(viewport, (int32)j, formulaPixelIsC, params, radius, maxIterations, row);
+                else if (fractalType == FractalType::Newton)
+                    newton->RenderRow(viewport, (int32)j, newtonTolerance, maxIterations, row, target.RootRow(targetRow));
+                else
+                    RenderRow(fractalType, viewport, (int32)j, params, orbitTrap, radius, maxIterations, row);
+
+                float32* values = target.Row(targetRow);
+                for (int32 i = 0; i < width; i++)
+                    values[i] = (float32)row[i];
+
+                if (field.IsSaved())
                 {
-                    case FractalType::Julia:
-                        result = Julia(x, y, real, imaginary, radius, maxIterations);
-                        break;
-                    case FractalType::Multibrot:
-                        result = Multibrot(x, y, MultibrotExponent, radius, maxIterations);
-                        break;
-                    case FractalType::Mandelbrot:
-                        result = Mandelbrot(x, y, radius, maxIterations);
-                        break;
+                    lock_guard lock(checkpointMutex);
+                    rowCompleted[j] = 1;
+                    while (rowsCompleted < height && rowCompleted[rowsCompleted])
+                        rowsCompleted++;
+
+                    if (chrono::steady_clock::now() - lastCheckpoint > chrono::seconds(10))
+                    {
+                        string fieldError;
+                        if (!field.Checkpoint(render, rowsCompleted, fieldError))
+                            Log(fieldError, true);
+                        lastCheckpoint = chrono::steady_clock::now();
+                    }
                 }
 
-                // If non-escaping, set result to defined value
-                if (result == -1)
-                    result = nonEscapingValue * (float64)maxIterations;
-
-                // Write to image vector RGBA format
-                float64 pixelValue = result / (result + falloffStrength);
-                int32 pixelLocation = 4 * width * j + 4 * i;
-                image[pixelLocation] = (uint8)(lerp(backgroundR, falloffR, pixelValue) * 255);
-                image[pixelLocation + 1] = (uint8)(lerp(backgroundG, falloffG, pixelValue) * 255);
-                image[pixelLocation + 2] = (uint8)(lerp(backgroundB, falloffB, pixelValue) * 255);
-                image[pixelLocation + 3] = (uint8)(lerp(backgroundA, 1, pixelValue) * 255);
+                // Print percentage complete
+                // TODO: fix percentage
+                int32 done = ++rowsDone;
+                if (thread == 0)
+                {
+                    auto now = chrono::high_resolution_clock::now();
+                    *LogOutput << "\r                                 \r" <<  setw(5) << ((double)(int)(((double)done / (double)height) * 10000)) / 100 << "% | " << duration_cast<chrono::milliseconds>(now - start) * (1/((double)done / (double)height)) - duration_cast<chrono::milliseconds>(now - start) << " remaining" << flush;
+                }
+            };
+            if (fuse)
+            {
+                ParallelFor(bandCount, [&](int64 band, int32 thread)
+                {
+                    for (int32 j = max((int32)band * bandRows, resumeRow); j < min((int32)(band + 1) * bandRows, height); j++)
+                        renderRow(j, thread);
+                    encodeBand((int32)band, thread);
+                });
+            }
+            else
+            {
+                ParallelFor(height - resumeRow, [&](int64 index, int32 thread)
+                {
+                    renderRow(resumeRow + index, thread);
+                });
             }
+            stop = chrono::high_resolution_clock::now();  // finish measuring the execution time
+            *LogOutput << "\r                                 \r";
 
-            // Print percentage complete
-            // TODO: fix percentage
-            stop = chrono::high_resolution_clock::now();
-            cout << "\r                                 \r" <<  setw(5) << ((double)(int)(((double)i / (double)width) * 10000)) / 100 << "% | " << duration_cast<chrono::milliseconds>(stop - start) * (1/((double)i / (double)width)) - duration_cast<chrono::milliseconds>(stop - start) << " remaining" << flush;
+            Log(format("{} frame in {}", fuse ? "Computed, coloured and encoded" : "Computed", duration_cast<chrono::milliseconds>(stop - start)));
+            *LogOutput << "\r                                 \r";
+
+            if (field.IsSaved())
+            {
+                string fieldError;
+                if (!field.Checkpoint(render, height, fieldError))
+                {
+                    Log(fieldError, true);
+                    return -3;
+                }
+            }
         }
-        stop = chrono::high_resolution_clock::now();  // finish measuring the execution time
-        cout << "\r                                 \r";
 
-        Log(format("Computed frame in {}", duration_cast<chrono::milliseconds>(stop - start)));
-        cout << "\r                                 \r";
+        // Colour the field
+        auto start = chrono::high_resolution_clock::now();
+        if (stream)
+        {
+            if (!fuse)
+            {
+                if (colours.mode == ColourMode::Histogram)
+                    colourMap.Equalize(field);
+                if (qoi || y4m)
+                {
+                    ParallelFor(bandCount, [&](int64 band, int32 thread)
+                    {
+                        encodeBand((int32)band, thread);
+                    });
+                }
+                else
+                {
+                    // The whole field is already there, so PNG bands are coloured on every thread and written in order,
+                    // each carrying on the deflate stream of the band before, which compresses a little better than
+                    // bands encoded on their own
+                    int32 orderedRows = PngWriter::BandRows(width);
+                    vector<uint8> pixels((size_t)width * orderedRows * (indexedOutput ? 1 : 4));
+                    for (int32 firstRow = 0; firstRow < height && writeError.empty(); firstRow += orderedRows)
+                    {
+                        int32 rowCount = min(orderedRows, height - firstRow);
+                        ParallelFor(rowCount, [&](int64 j, int32 thread)
+                        {
+                            if (indexedOutput)
+                                colourMap.IndexRows(field, firstRow + (int32)j, 1, dither, pixels.data() + (size_t)width * j);
+                            else
+                                colourMap.ColourRows(field, firstRow + (int32)j, 1, pixels.data() + (size_t)width * j * 4);
+                        });
+                        writer.WriteRows(pixels.data(), rowCount, writeError);
+                    }
+                }
+                Log(format("Coloured and encoded frame in {}", duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start)));
+            }
+
+            if (writeError.empty())
+            {
+                if (y4m)
+                    video.WriteFrame(writeError);
+                else if (qoi)
+                    qoiWriter.Close(writeError);
+                else
+                    writer.Close(writeError);
+            }
+            if (!writeError.empty())
+            {
+                Log(format("Failed to save to file '{}': {}", y4m ? videoPath : path.string(), writeError), true);
+                return -3;
+            }
+            if (y4m)
+            {
+                Log(format("Wrote frame to '{}' ({} bytes so far)\n", videoPath, video.Size()));
+                continue;
+            }
+            uint64 fileSize = qoi ? qoiWriter.Size() : writer.Size();
+            Log(format("Saved to file '{}' ({} bytes, {:.1f}% of the raw pixels)\n", path.string(), fileSize, (float64)fileSize / ((float64)width * height * 4) * 100));
+            continue;
+        }
+
+        if (colours.mode == ColourMode::Histogram)
+            colourMap.Equalize(field);
+
+        // Float images are saved without compression
+        if (floatOutput)
+        {
+            vector<float32> pixels((size_t)width * height * 4);
+            ParallelFor(height, [&](int64 j, int32 thread)
+            {
+                colourMap.ColourRowsFloat(field, (int32)j, 1, pixels.data() + (size_t)width * j * 4);
+            });
+            Log(format("Coloured frame in {}", duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start)));
+
+            start = chrono::high_resolution_clock::now();
+            string saveError;
+            bool saved = outputFormat == OutputFormat::Pfm
+                ? SavePfm(path, width, height, pixels, saveError)
+                : SaveExr(path, width, height, pixels, saveError);
+            if (!saved)
+            {
+                Log(format("Failed to save to file '{}': {}", path.string(), saveError), true);
+                return -3;
+            }
+            Log(format("Saved to file '{}' in {}\n", path.string(), duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start)));
+            continue;
+        }
+
+        // Indexed images never have RGBA pixels, only one byte per pixel, and 16-bit images have 8 bytes per pixel
+        size_t pixelBytes = indexedOutput ? 1 : bitDepth == 16 ? 8 : 4;
+        vector<uint8> image((size_t)width * height * pixelBytes);
+        ParallelFor(height, [&](int64 j, int32 thread)
+        {
+            uint8* row = image.data() + (size_t)width * j * pixelBytes;
+            if (indexedOutput)
+                colourMap.IndexRows(field, (int32)j, 1, dither, row);
+            else if (bitDepth == 16)
+                colourMap.ColourRows16(field, (int32)j, 1, row);
+            else
+                colourMap.ColourRows(field, (int32)j, 1, row);
+        });
+        Log(format("Coloured frame in {}", duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start)));
 
         // Encode and save
-        filesystem::path path = outputPath;
-        if (animate == false) path.append(format("julia_{}.png", to_string(time(nullptr)))).string();
-        else path.append(format("{}.png", frame+1));
+        // The size is reported with the time so encoder settings can be compared
+        start = chrono::high_resolution_clock::now();
+        if (apng)
+        {
+            string animationError;
+            if (!animation.WriteFrame(image, animationError))
+            {
+                Log(format("Failed to save to file '{}': {}", animationPath.string(), animationError), true);
+                return -3;
+            }
+            // Each frame is written once the next has been encoded, so the size is of the frame before
+            Log(format("Encoded frame in {} ({} bytes written so far)\n", duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start), animation.Size()));
+            continue;
+        }
         vector<uint8> output;
-        lodepng::encode(output, image, width, height);
+        uint32 error;
+        if (indexedOutput)
+            error = encoder.EncodeIndexed(image, width, height, indexedPalette, output);
+        else if (bitDepth == 16)
+        {
+            // Opaque frames leave out the alpha channel, as lodepng would have if it had searched the frame
+            LodePNGColorMode wideType = lodepng_color_mode_make(LCT_RGBA, 16);
+            LodePNGColorMode fileType = lodepng_color_mode_make(opaque ? LCT_RGB : LCT_RGBA, 16);
+            error = encoder.Encode(image, width, height, wideType, fileType, output);
+        }
+        else
+            error = encoder.Encode(image, width, height, frameColours, output);
+        if (error)
+        {
+            Log(format("Failed to encode image: {}", lodepng_error_text(error)), true);
+            return -3;
+        }
+        Log(format("Encoded frame in {} ({} bytes, {:.1f}% of the raw pixels)", duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start), output.size(), (float64)output.size() / ((float64)width * height * 4) * 100));
 
-        if (lodepng::save_file(output, path.string()) == 0)
+        // The frame is written while the next one is computed, only waiting once the queue is full
+        if (frameWriter)
+        {
+            string saveError;
+            if (!frameWriter->Write(path, move(output), saveError))
+            {
+                Log(saveError, true);
+                return -3;
+            }
+            Log(format("Saving to file '{}'\n", path.string()));
+        }
+        else if (lodepng::save_file(output, path.string()) == 0)
             Log(format("Saved to file '{}'\n", path.string()));
         else
         {
@@ -301,5 +1097,30 @@ int32 main()
             return -3;
         }
     }
+
+    string frameWriteError;
+    if (frameWriter && !frameWriter->Finish(frameWriteError))
+    {
+        Log(frameWriteError, true);
+        return -3;
+    }
+
+    if (apng)
+    {
+        string animationError;
+        if (!animation.Close(animationError))
+        {
+            Log(format("Failed to save to file '{}': {}", animationPath.string(), animationError), true);
+            return -3;
+        }
+        Log(format("Saved to file '{}' ({} bytes, {:.1f}% of the raw pixels)", animationPath.string(), animation.Size(), (float64)animation.Size() / ((float64)width * height * 4 * frameCount) * 100));
+    }
+
+    // The stream is only closed by the destructor if it was already written in full
+    if (y4m && !video.Close(videoError))
+    {
+        Log(format("Failed to write to '{}': {}", videoPath, videoError), true);
+        return -3;
+    }
     return 0;
 }
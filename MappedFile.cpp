@@ -0,0 +1,174 @@
+#include "MappedFile.h"
+
+#include <format>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        swap(data, other.data);
+        swap(size, other.size);
+        swap(file, other.file);
+#ifdef _WIN32
+        swap(mapping, other.mapping);
+#endif
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+static string LastError()
+{
+    return format("error {}", GetLastError());
+}
+
+static bool Map(MappedFile& mappedFile, void*& file, void*& mapping, uint8*& data, uint64 size, bool writable, string& error)
+{
+    mapping = CreateFileMappingW(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)(size >> 32), (DWORD)size, nullptr);
+    if (mapping)
+        data = (uint8*)MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)size);
+    if (!data)
+    {
+        error = format("Failed to map file: {}", LastError());
+        mappedFile.Close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::Create(const filesystem::path& path, uint64 newSize, string& error)
+{
+    Close();
+    file = CreateFileW(path.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)newSize;
+    if (file == INVALID_HANDLE_VALUE || !SetFilePointerEx(file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+    {
+        error = format("Failed to create '{}': {}", path.string(), LastError());
+        if (file == INVALID_HANDLE_VALUE) file = nullptr;
+        Close();
+        return false;
+    }
+    size = newSize;
+    return Map(*this, file, mapping, data, size, true, error);
+}
+
+bool MappedFile::Open(const filesystem::path& path, bool writable, string& error)
+{
+    Close();
+    file = CreateFileW(path.wstring().c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER fileSize;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize))
+    {
+        error = format("Failed to open '{}': {}", path.string(), LastError());
+        if (file == INVALID_HANDLE_VALUE) file = nullptr;
+        Close();
+        return false;
+    }
+    size = (uint64)fileSize.QuadPart;
+    return Map(*this, file, mapping, data, size, writable, error);
+}
+
+bool MappedFile::Flush()
+{
+    return data && FlushViewOfFile(data, 0) && FlushFileBuffers(file);
+}
+
+void MappedFile::Close()
+{
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+    data = nullptr;
+    mapping = file = nullptr;
+    size = 0;
+}
+
+#else
+
+static bool Map(MappedFile& mappedFile, int32 file, uint8*& data, uint64 size, bool writable, string& error)
+{
+    void* address = mmap(nullptr, size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, file, 0);
+    if (address == MAP_FAILED)
+    {
+        error = format("Failed to map file: {}", strerror(errno));
+        mappedFile.Close();
+        return false;
+    }
+    data = (uint8*)address;
+    return true;
+}
+
+bool MappedFile::Create(const filesystem::path& path, uint64 newSize, string& error)
+{
+    Close();
+    // The file is extended without writing it, so untouched pages take no space on most file systems
+    file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file < 0 || ftruncate(file, (off_t)newSize) != 0)
+    {
+        error = format("Failed to create '{}': {}", path.string(), strerror(errno));
+        Close();
+        return false;
+    }
+    size = newSize;
+    return Map(*this, file, data, size, true, error);
+}
+
+bool MappedFile::Open(const filesystem::path& path, bool writable, string& error)
+{
+    Close();
+    struct stat status;
+    file = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+    if (file < 0 || fstat(file, &status) != 0)
+    {
+        error = format("Failed to open '{}': {}", path.string(), strerror(errno));
+        Close();
+        return false;
+    }
+    size = (uint64)status.st_size;
+    return Map(*this, file, data, size, writable, error);
+}
+
+bool MappedFile::Flush()
+{
+    return data && msync(data, size, MS_SYNC) == 0;
+}
+
+void MappedFile::Close()
+{
+    if (data) munmap(data, size);
+    if (file >= 0) close(file);
+    data = nullptr;
+    file = -1;
+    size = 0;
+}
+
+#endif
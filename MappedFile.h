@@ -0,0 +1,44 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+#include "Types.h"
+
+// A file mapped into memory, pages are read and written back by the OS on demand
+// so mappings can be much larger than the available RAM
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    // Creates (or truncates) a file of the given size and maps it writable
+    bool Create(const std::filesystem::path& path, uint64 size, std::string& error);
+
+    // Maps an existing file in full
+    bool Open(const std::filesystem::path& path, bool writable, std::string& error);
+
+    // Writes modified pages back to the file and waits for them to reach the disk
+    bool Flush();
+
+    void Close();
+
+    uint8* Data() const { return data; }
+    uint64 Size() const { return size; }
+    bool IsOpen() const { return data != nullptr; }
+
+private:
+    uint8* data = nullptr;
+    uint64 size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int32 file = -1;
+#endif
+};
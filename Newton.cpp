@@ -0,0 +1,143 @@
+#include "Newton.h"
+
+#include <cmath>
+#include <format>
+
+using namespace std;
+
+// Finds every root at once with the Durand-Kerner method
+static vector<complex<float64>> FindRoots(const vector<complex<float64>>& coefficients)
+{
+    int32 degree = (int32)coefficients.size() - 1;
+    vector<complex<float64>> roots(degree);
+    for (int32 k = 0; k < degree; k++)
+        roots[k] = pow(complex<float64>(0.4, 0.9), k);
+
+    auto evaluate = [&](complex<float64> z)
+    {
+        complex<float64> p = 1;  // The polynomial is made monic by dividing through by the leading coefficient
+        for (int32 k = 1; k <= degree; k++)
+            p = p * z + coefficients[k] / coefficients[0];
+        return p;
+    };
+
+    for (int32 iteration = 0; iteration < 1000; iteration++)
+    {
+        float64 change = 0;
+        for (int32 k = 0; k < degree; k++)
+        {
+            complex<float64> denominator = 1;
+            for (int32 other = 0; other < degree; other++)
+                if (other != k)
+                    denominator *= roots[k] - roots[other];
+
+            complex<float64> step = evaluate(roots[k]) / denominator;
+            roots[k] -= step;
+            change = max(change, abs(step));
+        }
+
+        if (change < 1e-14)
+            break;
+    }
+    return roots;
+}
+
+optional<NewtonFractal> NewtonFractal::Create(const vector<complex<float64>>& coefficients, string& error)
+{
+    NewtonFractal fractal;
+
+    // Leading zeros don't change the polynomial
+    size_t first = 0;
+    while (first < coefficients.size() && coefficients[first] == 0.0)
+        first++;
+    fractal.coefficients.assign(coefficients.begin() + first, coefficients.end());
+
+    if (fractal.coefficients.size() < 2)
+    {
+        error = "Polynomial must have a degree of at least 1";
+        return nullopt;
+    }
+    if (fractal.coefficients.size() > NoRoot)
+    {
+        error = format("Polynomial must have a degree of at most {}", NoRoot - 1);
+        return nullopt;
+    }
+
+    fractal.roots = FindRoots(fractal.coefficients);
+    return fractal;
+}
+
+void NewtonFractal::RenderRow(const Viewport& viewport, int32 row, float64 tolerance, int32 iterationDepth, float64* out, uint8* rootIndices) const
+{
+    float64 toleranceSquared = tolerance * tolerance;
+    float64 logTolerance = log(tolerance);
+    int32 degree = (int32)coefficients.size() - 1;
+    float64 y = viewport.Y(row);
+
+    // Same lane scheme as EscapeTime(), converged lanes are frozen until the whole group is done
+    // The remainder of the row is run through the same kernel with the unused lanes already converged
+    for (int32 i = 0; i < viewport.width; i += LaneCount)
+    {
+        VecF64 zr, zi = y;
+        VecF64 iterations = 0;
+        VecF64 distance = 1;
+        VecF64 root = NoRoot;
+        VecMask active;
+        for (int32 k = 0; k < LaneCount; k++)
+        {
+            zr[k] = viewport.X(i + k);
+            active.m[k] = i + k < viewport.width ? -1 : 0;
+        }
+
+        for (int32 iteration = 1; iteration <= iterationDepth && Any(active); iteration++)
+        {
+            // Evaluate the polynomial and its derivative with Horner's method
+            VecF64 pr = coefficients[0].real(), pi = coefficients[0].imag();
+            VecF64 dr = 0, di = 0;
+            for (int32 k = 1; k <= degree; k++)
+            {
+                VecF64 tempR = dr * zr - di * zi + pr;
+                di = dr * zi + di * zr + pi;
+                dr = tempR;
+                tempR = pr * zr - pi * zi + coefficients[k].real();
+                pi = pr * zi + pi * zr + coefficients[k].imag();
+                pr = tempR;
+            }
+
+            // z -= p / p'
+            VecF64 denominator = dr * dr + di * di;
+            VecF64 stepR = (pr * dr + pi * di) / denominator;
+            VecF64 stepI = (pi * dr - pr * di) / denominator;
+            zr = Select(active, zr - stepR, zr);
+            zi = Select(active, zi - stepI, zi);
+
+            // Stop as soon as a lane is within the tolerance of one of the roots
+            for (int32 r = 0; r < degree; r++)
+            {
+                VecF64 deltaR = zr - roots[r].real();
+                VecF64 deltaI = zi - roots[r].imag();
+                VecF64 distanceSquared = deltaR * deltaR + deltaI * deltaI;
+                VecMask converged = active & (distanceSquared < toleranceSquared);
+                iterations = Select(converged, VecF64(iteration), iterations);
+                distance = Select(converged, distanceSquared, distance);
+                root = Select(converged, VecF64(r), root);
+                active = active & ~converged;
+            }
+        }
+
+        for (int32 k = 0; k < LaneCount && i + k < viewport.width; k++)
+        {
+            rootIndices[i + k] = (uint8)root[k];
+            if (root[k] == NoRoot)
+            {
+                out[i + k] = -1;
+                continue;
+            }
+
+            // Newton's method converges quadratically, so the number of digits gained past the tolerance
+            // on the last iteration gives the fractional part
+            float64 ret = iterations[k] - log2(max(0.5 * log(distance[k]) / logTolerance, 1.0));
+            out[i + k] = ret < 0 ? 0 : ret;
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <complex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+#include "Fractal.h"
+
+// Newton fractal of a polynomial, each pixel is coloured by the root Newton's method converges to from it
+class NewtonFractal
+{
+public:
+    // Marks pixels that did not converge to any root
+    static constexpr uint8 NoRoot = 255;
+
+    // Coefficients are ordered from the highest power down to the constant term
+    // Finds the roots of the polynomial, returns nothing and sets error if it has none
+    static std::optional<NewtonFractal> Create(const std::vector<std::complex<float64>>& coefficients, std::string& error);
+
+    // Computes the smoothed number of iterations each pixel in a row took to converge and the index of the root it converged to
+    // Pixels that don't converge get -1 and NoRoot
+    void RenderRow(const Viewport& viewport, int32 row, float64 tolerance, int32 iterationDepth, float64* out, uint8* roots) const;
+
+    const std::vector<std::complex<float64>>& Roots() const { return roots; }
+
+private:
+    std::vector<std::complex<float64>> coefficients;
+    std::vector<std::complex<float64>> roots;
+};
@@ -0,0 +1,47 @@
+#include "Parallel.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static int32 threadCount = 0;
+
+void SetThreadCount(int32 count)
+{
+    threadCount = count;
+}
+
+int32 ThreadCount()
+{
+    if (threadCount > 0)
+        return threadCount;
+    int32 cores = (int32)thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+void ParallelFor(int64 count, const function<void(int64 index, int32 thread)>& body)
+{
+    atomic<int64> next = 0;
+    auto worker = [&](int32 thread)
+    {
+        for (int64 index = next++; index < count; index = next++)
+            body(index, thread);
+    };
+
+    // The calling thread works too rather than waiting idle
+    vector<jthread> workers;
+    int32 threads = (int32)min<int64>(ThreadCount(), count);
+    for (int32 t = 1; t < threads; t++)
+        workers.emplace_back(worker, t);
+    worker(0);
+}
+
+void FirstError::Set(const string& newError)
+{
+    lock_guard lock(mutex);
+    if (!failed)
+        error = newError;
+    failed = true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "Types.h"
+
+// Sets the number of worker threads used by ParallelFor(), 0 uses one per core
+void SetThreadCount(int32 count);
+int32 ThreadCount();
+
+// Runs body(index, thread) for every index in [0, count) on the worker threads and returns once all are done
+// Indices are handed out in order as threads become free, so uneven work such as fractal rows stays balanced
+// thread is in [0, ThreadCount()) and can be used to index per-thread scratch space
+void ParallelFor(int64 count, const std::function<void(int64 index, int32 thread)>& body);
+
+// Keeps the first error hit by any of the threads of a ParallelFor(), which can stop taking work once there is one
+class FirstError
+{
+public:
+    bool Failed() const { return failed; }
+
+    // Ignored if there already is an error
+    void Set(const std::string& error);
+
+    // The first error, once the threads are done
+    const std::string& Error() const { return error; }
+
+private:
+    std::mutex mutex;
+    std::atomic<bool> failed = false;
+    std::string error;
+};
@@ -0,0 +1,91 @@
+#include "ParallelPng.h"
+#include "Types.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Large enough that the cost of restarting the Huffman blocks at every chunk stays small
+constexpr size_t ChunkSize = 256 * 1024;
+
+unsigned ParallelDeflate(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodePNGCompressSettings* settings)
+{
+    return ParallelDeflateChunk(out, outsize, in, 0, insize, settings, 1);
+}
+
+unsigned ParallelDeflateChunk(unsigned char** out, size_t* outsize, const unsigned char* in, size_t inpos, size_t insize, const LodePNGCompressSettings* settings, unsigned final)
+{
+    size_t chunkCount = (insize - inpos + ChunkSize - 1) / ChunkSize;
+    if (chunkCount <= 1 || ThreadCount() == 1)
+        return lodepng_deflate_chunk(out, outsize, in, inpos, insize, settings, final);
+
+    // Every chunk but the last ends byte-aligned, so the compressed chunks just need to be joined up in order
+    vector<unsigned char*> chunks(chunkCount, nullptr);
+    vector<size_t> chunkSizes(chunkCount, 0);
+    vector<unsigned> errors(chunkCount, 0);
+    ParallelFor((int64)chunkCount, [&](int64 chunk, int32 thread)
+    {
+        size_t start = inpos + chunk * ChunkSize;
+        size_t end = min(start + ChunkSize, insize);
+        errors[chunk] = lodepng_deflate_chunk(&chunks[chunk], &chunkSizes[chunk], in, start, end, settings, final && chunk == (int64)chunkCount - 1);
+    });
+
+    unsigned error = 0;
+    size_t total = 0;
+    for (size_t chunk = 0; chunk < chunkCount; chunk++)
+    {
+        error = error ? error : errors[chunk];
+        total += chunkSizes[chunk];
+    }
+
+    // lodepng frees the output with free()
+    if (!error)
+    {
+        *out = (unsigned char*)malloc(total);
+        *outsize = total;
+        if (!*out)
+            error = 83;
+    }
+    size_t position = 0;
+    for (size_t chunk = 0; chunk < chunkCount; chunk++)
+    {
+        if (!error)
+            memcpy(*out + position, chunks[chunk], chunkSizes[chunk]);
+        position += chunkSizes[chunk];
+        free(chunks[chunk]);
+    }
+    return error;
+}
+
+// Small enough to balance, large enough that the per-band scratch buffers don't matter
+constexpr unsigned BandHeight = 32;
+
+unsigned ParallelFilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, const LodePNGColorMode* color, const LodePNGEncoderSettings* settings)
+{
+    return ParallelFilterRows(out, in, w, 0, h, color, settings);
+}
+
+unsigned ParallelFilterRows(unsigned char* out, const unsigned char* in, unsigned w, unsigned y0, unsigned y1, const LodePNGColorMode* color, const LodePNGEncoderSettings* settings)
+{
+    unsigned bandCount = (y1 - y0 + BandHeight - 1) / BandHeight;
+    if (bandCount <= 1 || ThreadCount() == 1)
+        return lodepng_filter_rows(out, in, w, y0, y1, color, settings);
+
+    vector<unsigned> errors(bandCount, 0);
+    ParallelFor(bandCount, [&](int64 band, int32 thread)
+    {
+        unsigned start = y0 + (unsigned)band * BandHeight;
+        errors[band] = lodepng_filter_rows(out, in, w, start, min(start + BandHeight, y1), color, settings);
+    });
+
+    for (unsigned error : errors)
+    {
+        if (error)
+            return error;
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <lodepng.h>
+
+// Parts of PNG encoding spread over the worker threads, plugged into lodepng's custom hooks
+
+// Deflate for LodePNGCompressSettings::custom_deflate that compresses chunks of the input on every thread at once
+// Each chunk is primed with the window before it, so matches still reach back across chunk boundaries and the
+// output stays within a few percent of compressing the whole input in one go
+unsigned ParallelDeflate(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodePNGCompressSettings* settings);
+
+// ParallelDeflate of one piece of a longer stream, taking the same arguments as lodepng_deflate_chunk
+unsigned ParallelDeflateChunk(unsigned char** out, size_t* outsize, const unsigned char* in, size_t inpos, size_t insize, const LodePNGCompressSettings* settings, unsigned final);
+
+// Filter for LodePNGEncoderSettings::custom_filter that filters bands of rows on every thread at once
+// Each row is filtered from the unfiltered row above it, so the result is the same as filtering serially
+unsigned ParallelFilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, const LodePNGColorMode* color, const LodePNGEncoderSettings* settings);
+
+// ParallelFilter of the rows y0 to y1 only, taking the same arguments as lodepng_filter_rows
+unsigned ParallelFilterRows(unsigned char* out, const unsigned char* in, unsigned w, unsigned y0, unsigned y1, const LodePNGColorMode* color, const LodePNGEncoderSettings* settings);
@@ -0,0 +1,343 @@
+#include "PngWriter.h"
+#include "ParallelPng.h"
+#include "Bytes.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+
+using namespace std;
+
+// Large enough for every thread to get several deflate chunks of a band
+constexpr size_t BandBytes = 32 * 1024 * 1024;
+
+// A band's pixels and filtered rows together fill about a 2 MB L2 cache, smaller bands lose more to restarting deflate
+constexpr size_t CacheBandBytes = 1024 * 1024;
+
+// Adler-32 of two pieces of data one after the other, from the checksums of each piece, as zlib's adler32_combine
+static uint32 CombineAdler32(uint32 first, uint32 second, uint64 secondLength)
+{
+    constexpr uint32 Base = 65521;
+    uint32 remainder = (uint32)(secondLength % Base);
+    uint32 sum1 = first & 0xffff;
+    uint32 sum2 = (uint32)(((uint64)remainder * sum1) % Base);
+    sum1 += (second & 0xffff) + Base - 1;
+    sum2 += (first >> 16) + (second >> 16) + Base - remainder;
+    if (sum1 >= Base)
+        sum1 -= Base;
+    if (sum1 >= Base)
+        sum1 -= Base;
+    if (sum2 >= Base * 2)
+        sum2 -= Base * 2;
+    if (sum2 >= Base)
+        sum2 -= Base;
+    return sum2 << 16 | sum1;
+}
+
+PngWriter::PngWriter()
+{
+    lodepng_color_mode_init(&colourType);
+}
+
+PngWriter::~PngWriter()
+{
+    lodepng_color_mode_cleanup(&colourType);
+}
+
+int32 PngWriter::BandRows(int32 width)
+{
+    return (int32)max<size_t>(1, BandBytes / ((size_t)width * 4));
+}
+
+int32 PngWriter::CacheBandRows(int32 width)
+{
+    return (int32)max<size_t>(1, CacheBandBytes / ((size_t)width * 4));
+}
+
+bool PngWriter::Open(const filesystem::path& newPath, int32 newWidth, int32 newHeight, const PngEncoder& encoder, const vector<uint32>& colours, string& error)
+{
+    Reset(newPath, newWidth, newHeight, encoder);
+    if (!colours.empty())
+    {
+        // Sub-byte bit depths would need every converted row padded out to a whole byte
+        if (uint32 lodepngError = PngEncoder::ChooseColourType(colours, width, height, true, colourType))
+        {
+            error = format("Failed to choose the colour type: {}", lodepng_error_text(lodepngError));
+            return false;
+        }
+    }
+    return WriteHeader(error);
+}
+
+bool PngWriter::OpenIndexed(const filesystem::path& newPath, int32 newWidth, int32 newHeight, const PngEncoder& encoder, const vector<uint32>& palette, string& error)
+{
+    Reset(newPath, newWidth, newHeight, encoder);
+    if (uint32 lodepngError = PngEncoder::MakePalette(palette, colourType))
+    {
+        error = format("Failed to make the palette: {}", lodepng_error_text(lodepngError));
+        return false;
+    }
+    // As PngEncoder::EncodeIndexed, indices along a gradient are worth filtering
+    indexed = true;
+    settings.filter_palette_zero = 0;
+    return WriteHeader(error);
+}
+
+void PngWriter::Reset(const filesystem::path& newPath, int32 newWidth, int32 newHeight, const PngEncoder& encoder)
+{
+    path = newPath;
+    width = newWidth;
+    height = newHeight;
+    settings = encoder.Settings();
+    parallel = encoder.Backend() == DeflateBackend::Parallel;
+    rowsWritten = 0;
+    size = 0;
+    adler = 1;
+    lodepng_color_mode_cleanup(&colourType);
+    colourType = lodepng_color_mode_make(LCT_RGBA, 8);
+    indexed = false;
+    windowBytes = 0;
+    pendingBands.clear();
+}
+
+// Opens the file and writes every chunk before the image data, once the colour type is settled
+bool PngWriter::WriteHeader(string& error)
+{
+    rowBytes = lodepng_get_raw_size(width, 1, &colourType);
+    unfiltered.assign(rowBytes, 0);
+
+    file.open(path, ios::binary | ios::trunc);
+    if (!file)
+    {
+        error = format("Failed to open '{}'", path.string());
+        return false;
+    }
+
+    static const uint8 Signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    file.write((const char*)Signature, sizeof(Signature));
+    size += sizeof(Signature);
+
+    chunk.assign(4 + 13, 0);
+    WriteUint32(&chunk[4], width);
+    WriteUint32(&chunk[8], height);
+    chunk[12] = (uint8)colourType.bitdepth;
+    chunk[13] = (uint8)colourType.colortype;  // Compression, filter and interlace methods stay 0
+    if (!WriteChunk("IHDR", error))
+        return false;
+
+    // The palette and the transparency of its entries, or the one colour that is transparent
+    if (colourType.colortype == LCT_PALETTE)
+    {
+        chunk.assign(4 + colourType.palettesize * 3, 0);
+        for (size_t k = 0; k < colourType.palettesize; k++)
+            memcpy(&chunk[4 + k * 3], &colourType.palette[k * 4], 3);
+        if (!WriteChunk("PLTE", error))
+            return false;
+
+        bool opaque = true;
+        chunk.assign(4 + colourType.palettesize, 0);
+        for (size_t k = 0; k < colourType.palettesize; k++)
+        {
+            chunk[4 + k] = colourType.palette[k * 4 + 3];
+            opaque = opaque && chunk[4 + k] == 255;
+        }
+        if (!opaque && !WriteChunk("tRNS", error))
+            return false;
+    }
+    else if (colourType.key_defined)
+    {
+        uint32 keys[3] = { colourType.key_r, colourType.key_g, colourType.key_b };
+        int32 keyCount = colourType.colortype == LCT_GREY ? 1 : 3;
+        chunk.assign(4 + keyCount * 2, 0);
+        for (int32 k = 0; k < keyCount; k++)
+            WriteUint16(&chunk[4 + k * 2], keys[k]);
+        if (!WriteChunk("tRNS", error))
+            return false;
+    }
+    return true;
+}
+
+bool PngWriter::WriteRows(const uint8* pixels, int32 rowCount, string& error)
+{
+    if (rowCount > height - rowsWritten)
+    {
+        error = format("Tried to write {} rows past the bottom of the image", rowCount - (height - rowsWritten));
+        return false;
+    }
+
+    // The row above the band goes first, and starts out as zeros as they filter the first row the same as no row at all
+    LodePNGColorMode rgbaType = lodepng_color_mode_make(LCT_RGBA, 8);
+    unfiltered.resize(rowBytes * (rowCount + 1));
+    unsigned lodepngError = lodepng_convert(unfiltered.data() + rowBytes, pixels, &colourType, indexed ? &colourType : &rgbaType, width, rowCount);
+
+    // Filtered rows follow the filter type byte, after room for the window and for the unused filtered row above the band
+    size_t filteredRowBytes = rowBytes + 1;
+    size_t bandStart = settings.zlibsettings.windowsize + filteredRowBytes;
+    size_t bandBytes = filteredRowBytes * rowCount;
+    filtered.resize(bandStart + bandBytes);
+    uint8* filteredRows = filtered.data() + settings.zlibsettings.windowsize;
+    if (!lodepngError)
+    {
+        lodepngError = parallel
+            ? ParallelFilterRows(filteredRows, unfiltered.data(), width, 1, rowCount + 1, &colourType, &settings)
+            : lodepng_filter_rows(filteredRows, unfiltered.data(), width, 1, rowCount + 1, &colourType, &settings);
+    }
+
+    // Each band carries on the deflate stream of the band before, with the end of it in the window
+    bool final = rowsWritten + rowCount == height;
+    const uint8* in = filtered.data() + bandStart - windowBytes;
+    uint8* compressed = nullptr;
+    size_t compressedSize = 0;
+    if (!lodepngError)
+    {
+        lodepngError = parallel
+            ? ParallelDeflateChunk(&compressed, &compressedSize, in, windowBytes, windowBytes + bandBytes, &settings.zlibsettings, final)
+            : lodepng_deflate_chunk(&compressed, &compressedSize, in, windowBytes, windowBytes + bandBytes, &settings.zlibsettings, final);
+    }
+    if (lodepngError)
+    {
+        free(compressed);
+        error = format("Failed to encode rows: {}", lodepng_error_text(lodepngError));
+        return false;
+    }
+    adler = lodepng_update_adler32(adler, filtered.data() + bandStart, bandBytes);
+    bool written = WriteData(compressed, compressedSize, final, error);
+    free(compressed);
+    if (!written)
+        return false;
+
+    // Keep what the next band needs, the last row and the end of the filtered data
+    memcpy(unfiltered.data(), unfiltered.data() + rowBytes * rowCount, rowBytes);
+    size_t newWindowBytes = min<size_t>(settings.zlibsettings.windowsize, windowBytes + bandBytes);
+    memmove(filtered.data() + bandStart - newWindowBytes, filtered.data() + bandStart + bandBytes - newWindowBytes, newWindowBytes);
+    windowBytes = newWindowBytes;
+    rowsWritten += rowCount;
+    return true;
+}
+
+bool PngWriter::WriteBand(int32 firstRow, const uint8* pixels, int32 rowCount, string& error)
+{
+    if (firstRow < 0 || rowCount > height - firstRow)
+    {
+        error = format("Rows {} to {} are outside of the image", firstRow, firstRow + rowCount - 1);
+        return false;
+    }
+
+    // Rows already in the colour type of the file are filtered where they are
+    LodePNGColorMode rgbaType = lodepng_color_mode_make(LCT_RGBA, 8);
+    unsigned lodepngError = 0;
+    vector<uint8> converted;
+    const uint8* rows = pixels;
+    if (!indexed && (colourType.colortype != LCT_RGBA || colourType.bitdepth != 8))
+    {
+        converted.resize(rowBytes * rowCount);
+        lodepngError = lodepng_convert(converted.data(), pixels, &colourType, &rgbaType, width, rowCount);
+        rows = converted.data();
+    }
+
+    // Sub is the only filter besides None that doesn't look at the row above
+    LodePNGEncoderSettings firstRowSettings = settings;
+    if (firstRow > 0 && settings.filter_strategy != LFS_ZERO)
+        firstRowSettings.filter_strategy = LFS_ONE;
+    vector<uint8> filtered((rowBytes + 1) * rowCount);
+    if (!lodepngError)
+        lodepngError = lodepng_filter_rows(filtered.data(), rows, width, 0, 1, &colourType, &firstRowSettings);
+    if (!lodepngError)
+        lodepngError = lodepng_filter_rows(filtered.data(), rows, width, 1, rowCount, &colourType, &settings);
+
+    bool final = firstRow + rowCount == height;
+    uint8* compressed = nullptr;
+    size_t compressedSize = 0;
+    if (!lodepngError)
+        lodepngError = lodepng_deflate_chunk(&compressed, &compressedSize, filtered.data(), 0, filtered.size(), &settings.zlibsettings, final);
+    if (lodepngError)
+    {
+        free(compressed);
+        error = format("Failed to encode rows: {}", lodepng_error_text(lodepngError));
+        return false;
+    }
+    PendingBand band = { vector<uint8>(compressed, compressed + compressedSize), lodepng_update_adler32(1, filtered.data(), filtered.size()), filtered.size(), rowCount };
+    free(compressed);
+
+    lock_guard lock(bandMutex);
+    if (firstRow < rowsWritten || pendingBands.contains(firstRow))
+    {
+        error = format("Rows from {} were already written", firstRow);
+        return false;
+    }
+    pendingBands[firstRow] = move(band);
+    while (!pendingBands.empty() && pendingBands.begin()->first == rowsWritten)
+    {
+        PendingBand& next = pendingBands.begin()->second;
+        adler = CombineAdler32(adler, next.adler, next.filteredBytes);
+        if (!WriteData(next.compressed.data(), next.compressed.size(), rowsWritten + next.rowCount == height, error))
+            return false;
+        rowsWritten += next.rowCount;
+        pendingBands.erase(pendingBands.begin());
+    }
+    return true;
+}
+
+bool PngWriter::Close(string& error)
+{
+    if (rowsWritten != height)
+    {
+        error = format("Only {} of {} rows were written", rowsWritten, height);
+        file.close();
+        return false;
+    }
+
+    chunk.assign(4, 0);
+    if (!WriteChunk("IEND", error))
+        return false;
+    file.close();
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", path.string());
+        return false;
+    }
+    return true;
+}
+
+// Writes the next piece of the deflate stream, with the zlib header in front of the first piece and the checksum after the last
+bool PngWriter::WriteData(const uint8* compressed, size_t compressedSize, bool final, string& error)
+{
+    size_t headerBytes = rowsWritten == 0 ? 2 : 0;
+    chunk.resize(4 + headerBytes + compressedSize + (final ? 4 : 0));
+    if (headerBytes)
+    {
+        chunk[4] = 0x78;  // Deflate with a 32 KB window
+        chunk[5] = 0x01;  // No dictionary, lowest compression level hint, check bits
+    }
+    memcpy(&chunk[4 + headerBytes], compressed, compressedSize);
+    if (final)
+        WriteUint32(&chunk[4 + headerBytes + compressedSize], adler);
+    return WriteChunk("IDAT", error);
+}
+
+// The chunk's data is in chunk from its 5th byte on, leaving room for the type in front as the CRC covers both
+bool PngWriter::WriteChunk(const char* type, string& error)
+{
+    size_t length = chunk.size() - 4;
+    if (length > 0x7fffffff)
+    {
+        error = "A band of rows compressed to more than a PNG chunk can hold";
+        return false;
+    }
+    memcpy(chunk.data(), type, 4);
+
+    uint8 lengthBytes[4], crc[4];
+    WriteUint32(lengthBytes, (uint32)length);
+    WriteUint32(crc, lodepng_crc32(chunk.data(), chunk.size()));
+    file.write((const char*)lengthBytes, 4);
+    file.write((const char*)chunk.data(), chunk.size());
+    file.write((const char*)crc, 4);
+    size += chunk.size() + 8;
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", path.string());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <lodepng.h>
+
+#include "Types.h"
+#include "Encoder.h"
+
+// Writes a PNG file a band of rows at a time, for images too large to hold in memory
+// Each band is filtered and deflated as it arrives and goes straight to the file as an IDAT chunk,
+// so the memory used depends on the size of a band rather than the size of the image
+// Pixels are given as 8-bit RGBA, and written as RGBA unless every colour the image can have is known up front, as
+// the best colour type can't otherwise be known before the last row
+class PngWriter
+{
+public:
+    PngWriter();
+    ~PngWriter();
+
+    // Rows per band that keeps the buffers of a band to a few tens of MB
+    static int32 BandRows(int32 width);
+
+    // Writes the header of a width x height image, compressed with the encoder's settings
+    // colours are every pixel the image can have, as ColourMap::Colours gives them, to pick a smaller colour type
+    // than RGBA the same way lodepng would, or empty to write RGBA
+    bool Open(const std::filesystem::path& path, int32 width, int32 height, const PngEncoder& encoder, const std::vector<uint32>& colours, std::string& error);
+
+    // Writes the header of an 8-bit palette image, whose rows are then given as one byte indices into palette, as
+    // ColourMap::IndexRows gives them, instead of RGBA pixels
+    bool OpenIndexed(const std::filesystem::path& path, int32 width, int32 height, const PngEncoder& encoder, const std::vector<uint32>& palette, std::string& error);
+
+    // Appends rowCount rows of RGBA pixels, or indices of an indexed image, below the rows written so far
+    bool WriteRows(const uint8* pixels, int32 rowCount, std::string& error);
+
+    // Rows per band that keeps a band in the L2 cache while it is coloured, filtered and compressed
+    static int32 CacheBandRows(int32 width);
+
+    // Filters and compresses a band of rows on the calling thread, without looking at any other band, so bands can be
+    // encoded on every thread at once while they are still in cache
+    // Bands can come in any order, each is written as soon as every band above it has been
+    // As the row above a band may not be coloured yet, the first row of a band is only filtered with filters that don't
+    // use it, and the deflate window starts empty at each band, which makes the file slightly larger than WriteRows
+    bool WriteBand(int32 firstRow, const uint8* pixels, int32 rowCount, std::string& error);
+
+    // Ends the file, once every row has been written
+    bool Close(std::string& error);
+
+    // Bytes written to the file so far
+    uint64 Size() const { return size; }
+
+private:
+    // Compressed bands waiting for the bands above them
+    struct PendingBand
+    {
+        std::vector<uint8> compressed;
+        uint32 adler;
+        size_t filteredBytes;
+        int32 rowCount;
+    };
+
+    void Reset(const std::filesystem::path& path, int32 width, int32 height, const PngEncoder& encoder);
+    bool WriteHeader(std::string& error);
+    bool WriteData(const uint8* compressed, size_t compressedSize, bool final, std::string& error);
+    bool WriteChunk(const char* type, std::string& error);
+
+    std::ofstream file;
+    std::filesystem::path path;
+    LodePNGEncoderSettings settings = {};
+    LodePNGColorMode colourType = {};  // Of the file, the rows given are 8-bit RGBA unless indexed
+    bool indexed = false;             // Whether the rows given are already in the colour type of the file
+    size_t rowBytes = 0;              // Of a row in the colour type of the file
+    bool parallel = false;
+    int32 width = 0;
+    int32 height = 0;
+    int32 rowsWritten = 0;
+    uint64 size = 0;
+    uint32 adler = 1;
+
+    // Unfiltered rows of the band after the last row of the band before, which the first row is filtered against
+    std::vector<uint8> unfiltered;
+    // Filtered rows of the band after the end of the filtered data before, which primes the deflate window
+    std::vector<uint8> filtered;
+    size_t windowBytes = 0;
+    std::vector<uint8> chunk;  // Type and data of the chunk being written
+
+    std::mutex bandMutex;
+    std::map<int32, PendingBand> pendingBands;  // By first row
+};
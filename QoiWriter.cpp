@@ -0,0 +1,185 @@
+#include "QoiWriter.h"
+#include "Bytes.h"
+
+#include <cstring>
+#include <format>
+
+using namespace std;
+
+// Operations of the QOI format, each starting with its tag
+constexpr uint8 OpIndex = 0x00;  // 6-bit position in the index of recently seen pixels
+constexpr uint8 OpDiff = 0x40;   // Differences from the previous pixel of -2 to 1 for each of r, g and b
+constexpr uint8 OpLuma = 0x80;   // Difference of green from -32 to 31, red and blue differ from it by -8 to 7
+constexpr uint8 OpRun = 0xc0;    // 1 to 62 repeats of the previous pixel
+constexpr uint8 OpRgb = 0xfe;
+constexpr uint8 OpRgba = 0xff;
+constexpr int32 MaxRun = 62;
+
+static const uint8 EndMarker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+bool QoiWriter::Open(const filesystem::path& newPath, int32 newWidth, int32 newHeight, bool opaque, string& error)
+{
+    path = newPath;
+    width = newWidth;
+    height = newHeight;
+    rowsWritten = 0;
+    size = 0;
+    pendingBands.clear();
+
+    file.open(path, ios::binary | ios::trunc);
+    if (!file)
+    {
+        error = format("Failed to open '{}'", path.string());
+        return false;
+    }
+
+    vector<uint8> header(14);
+    memcpy(header.data(), "qoif", 4);
+    WriteUint32(&header[4], width);
+    WriteUint32(&header[8], height);
+    header[12] = opaque ? 3 : 4;
+    header[13] = 0;  // sRGB with linear alpha
+    return Write(header, error);
+}
+
+bool QoiWriter::WriteBand(int32 firstRow, const uint8* rgba, int32 rowCount, string& error)
+{
+    if (firstRow < 0 || rowCount > height - firstRow)
+    {
+        error = format("Rows {} to {} are outside of the image", firstRow, firstRow + rowCount - 1);
+        return false;
+    }
+
+    PendingBand band = { {}, rowCount };
+    EncodeBand(rgba, (size_t)width * rowCount, band.encoded);
+
+    lock_guard lock(bandMutex);
+    if (firstRow < rowsWritten || pendingBands.contains(firstRow))
+    {
+        error = format("Rows from {} were already written", firstRow);
+        return false;
+    }
+    pendingBands[firstRow] = move(band);
+    while (!pendingBands.empty() && pendingBands.begin()->first == rowsWritten)
+    {
+        PendingBand& next = pendingBands.begin()->second;
+        if (!Write(next.encoded, error))
+            return false;
+        rowsWritten += next.rowCount;
+        pendingBands.erase(pendingBands.begin());
+    }
+    return true;
+}
+
+bool QoiWriter::Close(string& error)
+{
+    if (rowsWritten != height)
+    {
+        error = format("Only {} of {} rows were written", rowsWritten, height);
+        file.close();
+        return false;
+    }
+
+    if (!Write(vector<uint8>(begin(EndMarker), end(EndMarker)), error))
+        return false;
+    file.close();
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", path.string());
+        return false;
+    }
+    return true;
+}
+
+void QoiWriter::EncodeBand(const uint8* rgba, size_t pixelCount, vector<uint8>& out)
+{
+    if (pixelCount == 0)
+        return;
+
+    // No pixel takes more than 5 bytes, so the output is sized once up front and trimmed at the end
+    size_t start = out.size();
+    out.resize(start + pixelCount * 5);
+    uint8* output = out.data() + start;
+    const uint32* pixels = (const uint32*)rgba;
+
+    // Entries of the index from before the band aren't known, so only entries set by this band are looked up
+    uint32 index[64];
+    uint64 indexSet = 0;
+    auto hash = [](const uint8* pixel) { return (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) & 63; };
+
+    // The first pixel is written in full, as the decoder's previous pixel is from the band before
+    const uint8* pixel = rgba;
+    *output++ = OpRgba;
+    memcpy(output, pixel, 4);
+    output += 4;
+    index[hash(pixel)] = pixels[0];
+    indexSet |= (uint64)1 << hash(pixel);
+
+    size_t i = 1;
+    while (i < pixelCount)
+    {
+        // Runs are the most common operation in the flat areas of a fractal, so they are found without the rest
+        if (pixels[i] == pixels[i - 1])
+        {
+            size_t runEnd = i + 1;
+            while (runEnd < pixelCount && pixels[runEnd] == pixels[i - 1])
+                runEnd++;
+            for (size_t run = runEnd - i; run > 0; run -= min<size_t>(run, MaxRun))
+                *output++ = (uint8)(OpRun | (min<size_t>(run, MaxRun) - 1));
+            i = runEnd;
+            continue;
+        }
+
+        pixel = rgba + i * 4;
+        const uint8* previous = pixel - 4;
+        int32 position = hash(pixel);
+        if ((indexSet >> position & 1) && index[position] == pixels[i])
+            *output++ = (uint8)(OpIndex | position);
+        else
+        {
+            index[position] = pixels[i];
+            indexSet |= (uint64)1 << position;
+            if (pixel[3] == previous[3])
+            {
+                int8 dr = (int8)(pixel[0] - previous[0]);
+                int8 dg = (int8)(pixel[1] - previous[1]);
+                int8 db = (int8)(pixel[2] - previous[2]);
+                int8 drg = (int8)(dr - dg);
+                int8 dbg = (int8)(db - dg);
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                    *output++ = (uint8)(OpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+                {
+                    *output++ = (uint8)(OpLuma | (dg + 32));
+                    *output++ = (uint8)((drg + 8) << 4 | (dbg + 8));
+                }
+                else
+                {
+                    *output++ = OpRgb;
+                    memcpy(output, pixel, 3);
+                    output += 3;
+                }
+            }
+            else
+            {
+                *output++ = OpRgba;
+                memcpy(output, pixel, 4);
+                output += 4;
+            }
+        }
+        i++;
+    }
+    out.resize(output - out.data());
+}
+
+bool QoiWriter::Write(const vector<uint8>& data, string& error)
+{
+    file.write((const char*)data.data(), data.size());
+    size += data.size();
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", path.string());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cmath>
+
+#include "Types.h"
+
+// Number of pixels the vectorized kernels iterate together
+// The lanes are plain loops, which the compiler packs into SSE2 instructions on x86-64, nothing here targets AVX
+// Compiling the kernels again for AVX2 was measured to be no faster, as they are held up by the chain of dependent
+// operations of each iteration rather than by the width of the registers
+constexpr int32 LaneCount = 4;
+
+struct VecMask
+{
+    int64 m[LaneCount];
+};
+
+struct VecF64
+{
+    float64 v[LaneCount];
+
+    VecF64() = default;
+    VecF64(float64 scalar) { for (int32 k = 0; k < LaneCount; k++) v[k] = scalar; }
+
+    float64& operator[](int32 k) { return v[k]; }
+    float64 operator[](int32 k) const { return v[k]; }
+};
+
+#define VEC_BINARY_OP(op)                                                                                   \
+    inline VecF64 operator op(const VecF64& a, const VecF64& b)                                             \
+    {                                                                                                       \
+        VecF64 r;                                                                                           \
+        for (int32 k = 0; k < LaneCount; k++) r.v[k] = a.v[k] op b.v[k];                                    \
+        return r;                                                                                           \
+    }                                                                                                       \
+    inline VecF64 operator op(const VecF64& a, float64 b) { return a op VecF64(b); }                        \
+    inline VecF64 operator op(float64 a, const VecF64& b) { return VecF64(a) op b; }
+
+VEC_BINARY_OP(+)
+VEC_BINARY_OP(-)
+VEC_BINARY_OP(*)
+VEC_BINARY_OP(/)
+
+#undef VEC_BINARY_OP
+
+inline VecF64 operator-(const VecF64& a)
+{
+    VecF64 r;
+    for (int32 k = 0; k < LaneCount; k++) r.v[k] = -a.v[k];
+    return r;
+}
+
+inline VecMask operator<(const VecF64& a, const VecF64& b)
+{
+    VecMask r;
+    for (int32 k = 0; k < LaneCount; k++) r.m[k] = a.v[k] < b.v[k] ? -1 : 0;
+    return r;
+}
+
+inline VecMask operator&(const VecMask& a, const VecMask& b)
+{
+    VecMask r;
+    for (int32 k = 0; k < LaneCount; k++) r.m[k] = a.m[k] & b.m[k];
+    return r;
+}
+
+inline VecMask operator~(const VecMask& a)
+{
+    VecMask r;
+    for (int32 k = 0; k < LaneCount; k++) r.m[k] = ~a.m[k];
+    return r;
+}
+
+inline bool Any(const VecMask& a)
+{
+    int64 any = 0;
+    for (int32 k = 0; k < LaneCount; k++) any |= a.m[k];
+    return any != 0;
+}
+
+// Picks a where the mask is set and b elsewhere
+inline VecF64 Select(const VecMask& mask, const VecF64& a, const VecF64& b)
+{
+    VecF64 r;
+    for (int32 k = 0; k < LaneCount; k++) r.v[k] = mask.m[k] ? a.v[k] : b.v[k];
+    return r;
+}
+
+// Scalar overloads so kernels can be written once for float64 and VecF64
+inline bool Any(bool a) { return a; }
+inline float64 Select(bool mask, float64 a, float64 b) { return mask ? a : b; }
+
+#define VEC_UNARY_FUNCTION(name, function)                                                                  \
+    inline VecF64 name(const VecF64& a)                                                                     \
+    {                                                                                                       \
+        VecF64 r;                                                                                           \
+        for (int32 k = 0; k < LaneCount; k++) r.v[k] = function(a.v[k]);                                    \
+        return r;                                                                                           \
+    }                                                                                                       \
+    inline float64 name(float64 a) { return function(a); }
+
+VEC_UNARY_FUNCTION(Abs, std::fabs)
+VEC_UNARY_FUNCTION(Sqrt, std::sqrt)
+VEC_UNARY_FUNCTION(Log, std::log)
+VEC_UNARY_FUNCTION(Sin, std::sin)
+VEC_UNARY_FUNCTION(Cos, std::cos)
+
+#undef VEC_UNARY_FUNCTION
+
+inline VecF64 Atan2(const VecF64& y, const VecF64& x)
+{
+    VecF64 r;
+    for (int32 k = 0; k < LaneCount; k++) r.v[k] = std::atan2(y.v[k], x.v[k]);
+    return r;
+}
+inline float64 Atan2(float64 y, float64 x) { return std::atan2(y, x); }
+
+inline VecF64 Pow(const VecF64& a, float64 exponent)
+{
+    VecF64 r;
+    for (int32 k = 0; k < LaneCount; k++) r.v[k] = std::pow(a.v[k], exponent);
+    return r;
+}
+inline float64 Pow(float64 a, float64 exponent) { return std::pow(a, exponent); }
+
+inline VecF64 Min(const VecF64& a, const VecF64& b)
+{
+    VecF64 r;
+    for (int32 k = 0; k < LaneCount; k++) r.v[k] = a.v[k] < b.v[k] ? a.v[k] : b.v[k];
+    return r;
+}
+inline float64 Min(float64 a, float64 b) { return a < b ? a : b; }
@@ -0,0 +1,185 @@
+#include "TiffWriter.h"
+#include "Bytes.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+
+using namespace std;
+
+// Field types of directory entries
+constexpr uint16 ShortType = 3;
+constexpr uint16 LongType = 4;
+constexpr uint16 Long8Type = 16;
+
+// Values of up to 8 bytes are held in the entry itself, from its first byte
+static void AddEntry(vector<uint8>& directory, uint16 tag, uint16 type, uint64 count, uint64 value)
+{
+    AppendLittleEndian(directory, tag);
+    AppendLittleEndian(directory, type);
+    AppendLittleEndian(directory, count);
+    AppendLittleEndian(directory, value);
+}
+
+bool TiffWriter::Open(const filesystem::path& newPath, int32 newWidth, int32 newHeight, int32 newTileSize, bool alpha, const PngEncoder& newEncoder, string& error)
+{
+    if (newTileSize <= 0 || newTileSize % 16 != 0)
+    {
+        error = format("Tiles must be a multiple of 16 pixels across, not {}", newTileSize);
+        return false;
+    }
+
+    path = newPath;
+    width = newWidth;
+    height = newHeight;
+    tileSize = newTileSize;
+    columns = (width + tileSize - 1) / tileSize;
+    rows = (height + tileSize - 1) / tileSize;
+    samples = alpha ? 4 : 3;
+    tileOffsets.assign((size_t)columns * rows, 0);
+    tileSizes.assign((size_t)columns * rows, 0);
+
+    // Tiles are already compressed on every thread at once
+    encoder = newEncoder.SingleThreaded();
+
+    file.open(path, ios::binary | ios::trunc);
+    if (!file)
+    {
+        error = format("Failed to open '{}'", path.string());
+        return false;
+    }
+
+    // BigTIFF header, whose offset of the directory is filled in once the tiles are written
+    vector<uint8> header = { 'I', 'I' };
+    AppendLittleEndian(header, (uint16)43);
+    AppendLittleEndian(header, (uint16)8);  // Bytes per offset
+    AppendLittleEndian(header, (uint16)0);
+    AppendLittleEndian(header, (uint64)0);
+    file.write((const char*)header.data(), header.size());
+    size = header.size();
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", path.string());
+        return false;
+    }
+    return true;
+}
+
+bool TiffWriter::WriteTile(int32 column, int32 row, const uint8* rgba, string& error)
+{
+    // Every tile is stored full size, edge tiles are padded with black
+    int32 tileWidth = min(tileSize, width - column * tileSize);
+    int32 tileHeight = min(tileSize, height - row * tileSize);
+    size_t rowBytes = (size_t)tileSize * samples;
+    vector<uint8> tile(rowBytes * tileSize);
+    vector<uint8> line(rowBytes);
+    for (int32 j = 0; j < tileHeight; j++)
+    {
+        const uint8* pixels = rgba + (size_t)j * tileWidth * 4;
+        if (samples == 4)
+            memcpy(line.data(), pixels, (size_t)tileWidth * 4);
+        else
+        {
+            for (int32 i = 0; i < tileWidth; i++)
+            {
+                line[i * 3] = pixels[i * 4];
+                line[i * 3 + 1] = pixels[i * 4 + 1];
+                line[i * 3 + 2] = pixels[i * 4 + 2];
+            }
+        }
+
+        // The horizontal predictor stores each sample as the difference from the pixel before, which turns gradients
+        // into runs that deflate well
+        uint8* out = &tile[rowBytes * j];
+        memcpy(out, line.data(), samples);
+        for (size_t k = samples; k < rowBytes; k++)
+            out[k] = (uint8)(line[k] - line[k - samples]);
+    }
+
+    vector<uint8> data;
+    if (uint32 lodepngError = encoder.Compress(tile.data(), tile.size(), data))
+    {
+        error = lodepng_error_text(lodepngError);
+        return false;
+    }
+
+    // Tiles go into the file in the order they are finished, wherever they are in the image
+    lock_guard lock(fileMutex);
+    size_t index = (size_t)row * columns + column;
+    tileOffsets[index] = size;
+    tileSizes[index] = data.size();
+    file.write((const char*)data.data(), data.size());
+    size += data.size();
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", path.string());
+        return false;
+    }
+    return true;
+}
+
+bool TiffWriter::WriteDirectory(string& error)
+{
+    // The directory starts on a word boundary, with the tile offsets and sizes after it
+    if (size % 2 != 0)
+    {
+        file.put(0);
+        size++;
+    }
+    uint64 directoryOffset = size;
+
+    uint64 tileCount = tileOffsets.size();
+    uint64 entryCount = samples == 4 ? 13 : 12;
+    uint64 arrays = directoryOffset + 8 + entryCount * 20 + 8;
+    vector<uint8> directory;
+    AppendLittleEndian(directory, entryCount);
+
+    // Entries are sorted by tag
+    AddEntry(directory, 256, LongType, 1, (uint64)width);
+    AddEntry(directory, 257, LongType, 1, (uint64)height);
+    AddEntry(directory, 258, ShortType, samples, 0x0008000800080008ull);  // 8 bits per sample
+    AddEntry(directory, 259, ShortType, 1, 8);  // zlib compressed
+    AddEntry(directory, 262, ShortType, 1, 2);  // RGB
+    AddEntry(directory, 277, ShortType, 1, (uint64)samples);
+    AddEntry(directory, 284, ShortType, 1, 1);  // Samples of a pixel together
+    AddEntry(directory, 317, ShortType, 1, 2);  // Horizontal predictor
+    AddEntry(directory, 322, LongType, 1, (uint64)tileSize);
+    AddEntry(directory, 323, LongType, 1, (uint64)tileSize);
+    AddEntry(directory, 324, Long8Type, tileCount, tileCount == 1 ? tileOffsets[0] : arrays);
+    AddEntry(directory, 325, Long8Type, tileCount, tileCount == 1 ? tileSizes[0] : arrays + tileCount * 8);
+    if (samples == 4)
+        AddEntry(directory, 338, ShortType, 1, 2);  // Straight alpha
+    AppendLittleEndian(directory, (uint64)0);  // No more directories
+
+    if (tileCount > 1)
+    {
+        size_t at = directory.size();
+        directory.resize(at + tileCount * 16);
+        memcpy(&directory[at], tileOffsets.data(), tileCount * 8);
+        memcpy(&directory[at + tileCount * 8], tileSizes.data(), tileCount * 8);
+    }
+    file.write((const char*)directory.data(), directory.size());
+    size += directory.size();
+
+    file.seekp(8);
+    file.write((const char*)&directoryOffset, 8);
+    file.close();
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", path.string());
+        return false;
+    }
+    return true;
+}
+
+bool TiffWriter::Close(string& error)
+{
+    size_t written = count_if(tileSizes.begin(), tileSizes.end(), [](uint64 tileBytes) { return tileBytes > 0; });
+    if (written != tileSizes.size())
+    {
+        error = format("Only {} of {} tiles were written", written, tileSizes.size());
+        file.close();
+        return false;
+    }
+    return WriteDirectory(error);
+}
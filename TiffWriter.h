@@ -0,0 +1,58 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+#include "Encoder.h"
+
+// Writes one image as a tiled BigTIFF, for prints larger than PNG readers cope with or than 32-bit file offsets reach
+// Tiles can be given in any order and from any thread, each is compressed on the thread that gives it and written as
+// soon as it is, so only a tile per thread is ever held in memory
+// Where each tile ended up is written in the directory after the last tile, so readers can still go straight to any tile
+class TiffWriter
+{
+public:
+    TiffWriter() = default;
+    TiffWriter(const TiffWriter&) = delete;
+    TiffWriter& operator=(const TiffWriter&) = delete;
+
+    // Starts a width x height image of tileSize x tileSize tiles, which must be a multiple of 16, deflated with the
+    // encoder's settings on the calling thread
+    // alpha keeps the alpha channel, which opaque images leave out
+    bool Open(const std::filesystem::path& path, int32 width, int32 height, int32 tileSize, bool alpha, const PngEncoder& encoder, std::string& error);
+
+    int32 Columns() const { return columns; }
+    int32 Rows() const { return rows; }
+
+    // Compresses and writes the tile at column, row, given as 8-bit RGBA of only the part inside the image, as
+    // TilePyramid::RenderTile gives it
+    // Safe to call from several threads at once
+    bool WriteTile(int32 column, int32 row, const uint8* rgba, std::string& error);
+
+    // Writes the directory of the tiles and ends the file, once every tile has been given
+    bool Close(std::string& error);
+
+    // Bytes written to the file so far
+    uint64 Size() const { return size; }
+
+private:
+    bool WriteDirectory(std::string& error);
+
+    std::ofstream file;
+    std::filesystem::path path;
+    PngEncoder encoder = { EncoderPreset::Balanced, DeflateBackend::Lodepng };
+    int32 width = 0;
+    int32 height = 0;
+    int32 tileSize = 0;
+    int32 columns = 0;
+    int32 rows = 0;
+    int32 samples = 4;
+    std::mutex fileMutex;
+    std::vector<uint64> tileOffsets;
+    std::vector<uint64> tileSizes;
+    uint64 size = 0;
+};
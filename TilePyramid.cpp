@@ -0,0 +1,252 @@
+#include "TilePyramid.h"
+#include "Parallel.h"
+
+#include <atomic>
+#include <cstring>
+#include <format>
+#include <fstream>
+
+using namespace std;
+
+TilePyramid::TilePyramid(TileLayout layout, const filesystem::path& path, int32 width, int32 height, int32 tileSize)
+    : layout(layout), path(path), width(width), height(height), tileSize(tileSize)
+{
+    // Deep Zoom halves the image down to a single pixel, XYZ only down to a single tile
+    int32 size = max(width, height);
+    int32 smallest = layout == TileLayout::DeepZoom ? 1 : tileSize;
+    int32 top = 0;
+    while ((int64)smallest << top < size)
+        top++;
+
+    // Halving the size of each level rounding up gives the same sizes as dividing the full size rounding up
+    for (int32 level = 0; level <= top; level++)
+    {
+        int32 shift = top - level;
+        int32 levelWidth = (int32)(((int64)width + (1ll << shift) - 1) >> shift);
+        int32 levelHeight = (int32)(((int64)height + (1ll << shift) - 1) >> shift);
+        levels.push_back({ levelWidth, levelHeight, (levelWidth + tileSize - 1) / tileSize, (levelHeight + tileSize - 1) / tileSize });
+    }
+}
+
+TilePyramid::Area TilePyramid::TileArea(int32 level, int32 column, int32 row) const
+{
+    int32 x = column * tileSize;
+    int32 y = row * tileSize;
+    return { x, y, min(tileSize, levels[level].width - x), min(tileSize, levels[level].height - y) };
+}
+
+filesystem::path TilePyramid::TilePath(int32 level, int32 column, int32 row) const
+{
+    if (layout == TileLayout::DeepZoom)
+        return filesystem::path(path.string() + "_files") / to_string(level) / format("{}_{}.png", column, row);
+    return path / to_string(level) / to_string(column) / format("{}.png", row);
+}
+
+bool TilePyramid::Save(const PngEncoder& encoder, int32 level, int32 column, int32 row, const vector<uint8>& pixels, const vector<uint32>& colours, vector<uint8>& image, string& error) const
+{
+    // XYZ viewers expect every tile to be full size, so edge tiles are padded with transparent pixels
+    Area area = TileArea(level, column, row);
+    const vector<uint8>* tile = &pixels;
+    int32 tileWidth = area.width;
+    int32 tileHeight = area.height;
+    bool padded = layout == TileLayout::Xyz && (area.width < tileSize || area.height < tileSize);
+    if (padded)
+    {
+        image.assign((size_t)tileSize * tileSize * 4, 0);
+        for (int32 j = 0; j < area.height; j++)
+            memcpy(&image[(size_t)j * tileSize * 4], &pixels[(size_t)j * area.width * 4], (size_t)area.width * 4);
+        tile = &image;
+        tileWidth = tileSize;
+        tileHeight = tileSize;
+    }
+
+    // The padding isn't one of the colours, so those tiles are left to lodepng
+    vector<uint8> png;
+    if (uint32 lodepngError = encoder.Encode(*tile, tileWidth, tileHeight, padded ? vector<uint32>() : colours, png))
+    {
+        error = lodepng_error_text(lodepngError);
+        return false;
+    }
+
+    // Tiles are written under another name first, so a stopped run never leaves a partial tile that a later one would keep
+    filesystem::path tilePath = TilePath(level, column, row);
+    filesystem::path partPath = tilePath;
+    partPath += ".part";
+    ofstream file(partPath, ios::binary | ios::trunc);
+    file.write((const char*)png.data(), png.size());
+    file.close();
+    error_code renameError;
+    if (file)
+        filesystem::rename(partPath, tilePath, renameError);
+    if (!file || renameError)
+    {
+        error = format("Failed to write to '{}'", tilePath.string());
+        return false;
+    }
+    return true;
+}
+
+bool TilePyramid::Downsample(int32 level, int32 column, int32 row, vector<uint8>& block, vector<uint8>& pixels, string& error) const
+{
+    // The up to four tiles under this one are put together in a block of the level below, twice the size of the tile
+    const Level& below = levels[level + 1];
+    int32 blockX = column * 2 * tileSize;
+    int32 blockY = row * 2 * tileSize;
+    int32 blockWidth = min(tileSize * 2, below.width - blockX);
+    int32 blockHeight = min(tileSize * 2, below.height - blockY);
+    block.resize((size_t)blockWidth * blockHeight * 4);
+    for (int32 childRow = row * 2; childRow < min(row * 2 + 2, below.rows); childRow++)
+    {
+        for (int32 childColumn = column * 2; childColumn < min(column * 2 + 2, below.columns); childColumn++)
+        {
+            vector<uint8> child;
+            uint32 childWidth, childHeight;
+            filesystem::path childPath = TilePath(level + 1, childColumn, childRow);
+            if (uint32 lodepngError = lodepng::decode(child, childWidth, childHeight, childPath.string()))
+            {
+                error = format("Failed to read '{}': {}", childPath.string(), lodepng_error_text(lodepngError));
+                return false;
+            }
+
+            // Padding past the edges of the level is left out
+            Area area = TileArea(level + 1, childColumn, childRow);
+            if ((int32)childWidth < area.width || (int32)childHeight < area.height)
+            {
+                error = format("Tile '{}' is {}x{}, smaller than the {}x{} expected", childPath.string(), childWidth, childHeight, area.width, area.height);
+                return false;
+            }
+            for (int32 j = 0; j < area.height; j++)
+                memcpy(&block[((size_t)(area.y - blockY + j) * blockWidth + area.x - blockX) * 4], &child[(size_t)j * childWidth * 4], (size_t)area.width * 4);
+        }
+    }
+
+    // Each pixel is the average of the 2x2 pixels under it, weighted by their alpha so transparent pixels don't darken it
+    // A level of odd size has a last row or column of pixels over only one row or column of the level below
+    Area area = TileArea(level, column, row);
+    pixels.resize((size_t)area.width * area.height * 4);
+    for (int32 j = 0; j < area.height; j++)
+    {
+        int32 rowCount = min(2, blockHeight - j * 2);
+        for (int32 i = 0; i < area.width; i++)
+        {
+            int32 columnCount = min(2, blockWidth - i * 2);
+            uint32 sums[3] = {};
+            uint32 alpha = 0;
+            for (int32 y = 0; y < rowCount; y++)
+            {
+                for (int32 x = 0; x < columnCount; x++)
+                {
+                    const uint8* pixel = &block[((size_t)(j * 2 + y) * blockWidth + i * 2 + x) * 4];
+                    for (int32 c = 0; c < 3; c++)
+                        sums[c] += pixel[c] * pixel[3];
+                    alpha += pixel[3];
+                }
+            }
+
+            uint8* pixel = &pixels[((size_t)j * area.width + i) * 4];
+            uint32 count = rowCount * columnCount;
+            for (int32 c = 0; c < 3; c++)
+                pixel[c] = alpha > 0 ? (uint8)((sums[c] + alpha / 2) / alpha) : 0;
+            pixel[3] = (uint8)((alpha + count / 2) / count);
+        }
+    }
+    return true;
+}
+
+bool TilePyramid::WriteDescriptor(string& error) const
+{
+    filesystem::path descriptorPath = path.string() + ".dzi";
+    ofstream file(descriptorPath, ios::trunc);
+    file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    file << format("<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"png\" Overlap=\"0\" TileSize=\"{}\">\n", tileSize);
+    file << format("  <Size Width=\"{}\" Height=\"{}\"/>\n", width, height);
+    file << "</Image>\n";
+    file.close();
+    if (!file)
+    {
+        error = format("Failed to write to '{}'", descriptorPath.string());
+        return false;
+    }
+    return true;
+}
+
+bool TilePyramid::Write(const PngEncoder& encoder, const vector<uint32>& colours, const RenderTile& renderTile, string& error)
+{
+    // Tiles are small and encoded on every thread at once already
+    PngEncoder tileEncoder = encoder.SingleThreaded();
+
+    error_code folderError;
+    for (int32 level = 0; level < LevelCount() && !folderError; level++)
+    {
+        if (layout == TileLayout::DeepZoom)
+            filesystem::create_directories(TilePath(level, 0, 0).parent_path(), folderError);
+        for (int32 column = 0; column < levels[level].columns && layout == TileLayout::Xyz && !folderError; column++)
+            filesystem::create_directories(TilePath(level, column, 0).parent_path(), folderError);
+    }
+    if (folderError)
+    {
+        error = format("Failed to create the tile folders under '{}': {}", path.parent_path().string(), folderError.message());
+        return false;
+    }
+
+    // The threads stop taking tiles once one of them fails
+    FirstError failure;
+
+    vector<vector<uint8>> pixels(ThreadCount()), images(ThreadCount()), blocks(ThreadCount());
+    atomic<int64> rendered = 0, downsampled = 0;
+
+    // Tiles written this run, whose tiles above have to be made again
+    int32 top = LevelCount() - 1;
+    vector<uint8> written((size_t)BaseTileCount());
+    ParallelFor(BaseTileCount(), [&](int64 index, int32 thread)
+    {
+        int32 column = (int32)(index % levels[top].columns);
+        int32 row = (int32)(index / levels[top].columns);
+        if (failure.Failed() || filesystem::exists(TilePath(top, column, row)))
+            return;
+
+        Area area = TileArea(top, column, row);
+        pixels[thread].resize((size_t)area.width * area.height * 4);
+        renderTile(area.x, area.y, area.width, area.height, thread, pixels[thread].data());
+        string tileError;
+        if (!Save(tileEncoder, top, column, row, pixels[thread], colours, images[thread], tileError))
+            return failure.Set(tileError);
+        written[index] = 1;
+        rendered++;
+    });
+
+    for (int32 level = top - 1; level >= 0 && !failure.Failed(); level--)
+    {
+        const Level& below = levels[level + 1];
+        vector<uint8> levelWritten((size_t)levels[level].columns * levels[level].rows);
+        ParallelFor(levelWritten.size(), [&](int64 index, int32 thread)
+        {
+            int32 column = (int32)(index % levels[level].columns);
+            int32 row = (int32)(index / levels[level].columns);
+            bool stale = false;
+            for (int32 childRow = row * 2; childRow < min(row * 2 + 2, below.rows); childRow++)
+            {
+                for (int32 childColumn = column * 2; childColumn < min(column * 2 + 2, below.columns); childColumn++)
+                    stale |= written[(size_t)childRow * below.columns + childColumn] != 0;
+            }
+            if (failure.Failed() || (!stale && filesystem::exists(TilePath(level, column, row))))
+                return;
+
+            string tileError;
+            if (!Downsample(level, column, row, blocks[thread], pixels[thread], tileError) || !Save(tileEncoder, level, column, row, pixels[thread], {}, images[thread], tileError))
+                return failure.Set(tileError);
+            levelWritten[index] = 1;
+            downsampled++;
+        });
+        written = move(levelWritten);
+    }
+
+    tilesRendered = rendered;
+    tilesDownsampled = downsampled;
+    if (failure.Failed())
+    {
+        error = failure.Error();
+        return false;
+    }
+    return layout != TileLayout::DeepZoom || WriteDescriptor(error);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+#include "Encoder.h"
+
+// How the tiles of a pyramid are laid out on disk
+enum class TileLayout
+{
+    None,      // One image, not a pyramid
+    DeepZoom,  // path.dzi describing path_files/level/column_row.png, level 0 being a single pixel, edge tiles cropped
+    Xyz        // path/z/x/y.png, zoom 0 being a single tile, every tile full size with transparent padding past the edges
+};
+
+// Writes a render far larger than one image as a pyramid of PNG tiles, for viewers that only load the tiles in view
+// Only the tiles of the full size level are rendered, each level above is made by halving the four tiles under each of
+// its tiles, read back from disk, so no pixel is computed twice and no level has to fit in memory
+// Tiles already on disk are kept, so a run that was stopped carries on where it left off, and the levels above only
+// remake the tiles over ones written this run
+// Tiles are found by name only, so the folder has to be removed when anything but the tile encoding changes
+class TilePyramid
+{
+public:
+    // Fills rgba with the width x height pixels whose top left pixel is (left, top) in the full size image, as 8-bit
+    // RGBA, using thread's scratch space
+    using RenderTile = std::function<void(int32 left, int32 top, int32 width, int32 height, int32 thread, uint8* rgba)>;
+
+    TilePyramid(TileLayout layout, const std::filesystem::path& path, int32 width, int32 height, int32 tileSize);
+
+    // Renders the missing tiles of the full size level on every thread, then makes each level above from the one below
+    // colours are every pixel a rendered tile can have, as ColourMap::Colours gives them
+    bool Write(const PngEncoder& encoder, const std::vector<uint32>& colours, const RenderTile& renderTile, std::string& error);
+
+    int32 LevelCount() const { return (int32)levels.size(); }
+    int64 BaseTileCount() const { return (int64)levels.back().columns * levels.back().rows; }
+
+    // Tiles rendered and made from the level below by the last Write, the rest were already on disk
+    int64 TilesRendered() const { return tilesRendered; }
+    int64 TilesDownsampled() const { return tilesDownsampled; }
+
+private:
+    struct Level
+    {
+        int32 width, height;
+        int32 columns, rows;
+    };
+
+    // Part of a level covered by a tile
+    struct Area
+    {
+        int32 x, y, width, height;
+    };
+
+    Area TileArea(int32 level, int32 column, int32 row) const;
+    std::filesystem::path TilePath(int32 level, int32 column, int32 row) const;
+    bool Downsample(int32 level, int32 column, int32 row, std::vector<uint8>& block, std::vector<uint8>& pixels, std::string& error) const;
+    bool Save(const PngEncoder& encoder, int32 level, int32 column, int32 row, const std::vector<uint8>& pixels, const std::vector<uint32>& colours, std::vector<uint8>& image, std::string& error) const;
+    bool WriteDescriptor(std::string& error) const;
+
+    TileLayout layout;
+    std::filesystem::path path;
+    int32 width;
+    int32 height;
+    int32 tileSize;
+    std::vector<Level> levels;  // From the smallest up to the full size image
+    int64 tilesRendered = 0;
+    int64 tilesDownsampled = 0;
+};
@@ -0,0 +1,154 @@
+#include "Y4mWriter.h"
+
+#include <format>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using namespace std;
+
+// Colour over a black background, as c * a / 255 rounded, written so the loops below vectorize
+static inline int32 Premultiply(int32 colour, int32 alpha)
+{
+    int32 x = colour * alpha + 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Rows are converted a channel at a time in plain loops over the row, which the compiler turns into packed instructions
+static void LumaRow(const uint8* rgba, int32 width, uint8* luma)
+{
+    for (int32 i = 0; i < width; i++)
+    {
+        const uint8* pixel = rgba + (size_t)i * 4;
+        int32 r = Premultiply(pixel[0], pixel[3]);
+        int32 g = Premultiply(pixel[1], pixel[3]);
+        int32 b = Premultiply(pixel[2], pixel[3]);
+        luma[i] = (uint8)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    }
+}
+
+// Each chroma sample is taken from the average of the 2x2 pixels it covers
+static void ChromaRow(const uint8* top, const uint8* bottom, int32 width, uint8* u, uint8* v)
+{
+    auto sample = [&](int32 left, int32 right, int32 i)
+    {
+        const uint8* pixels[4] = { top + (size_t)left * 4, top + (size_t)right * 4, bottom + (size_t)left * 4, bottom + (size_t)right * 4 };
+        int32 r = 2, g = 2, b = 2;
+        for (const uint8* pixel : pixels)
+        {
+            r += Premultiply(pixel[0], pixel[3]);
+            g += Premultiply(pixel[1], pixel[3]);
+            b += Premultiply(pixel[2], pixel[3]);
+        }
+        r >>= 2;
+        g >>= 2;
+        b >>= 2;
+        u[i] = (uint8)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        v[i] = (uint8)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    };
+
+    int32 pairs = width / 2;
+    for (int32 i = 0; i < pairs; i++)
+        sample(i * 2, i * 2 + 1, i);
+
+    // The last column of an odd width frame covers only itself
+    if (width % 2)
+        sample(width - 1, width - 1, pairs);
+}
+
+Y4mWriter::~Y4mWriter()
+{
+    string error;
+    Close(error);
+}
+
+bool Y4mWriter::Open(const string& newPath, int32 newWidth, int32 newHeight, int32 frameRate, string& error)
+{
+    path = newPath;
+    width = newWidth;
+    height = newHeight;
+    chromaWidth = (width + 1) / 2;
+    chromaHeight = (height + 1) / 2;
+    size = 0;
+    frame.assign((size_t)width * height + (size_t)chromaWidth * chromaHeight * 2, 0);
+
+    if (path == "-")
+    {
+        file = stdout;
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    }
+    else
+        file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        error = format("Failed to open '{}'", path);
+        return false;
+    }
+
+    // Square pixels, progressive, with the chroma siting of JPEG and MPEG-1
+    string header = format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C420jpeg\n", width, height, frameRate);
+    size += fwrite(header.data(), 1, header.size(), file);
+    if (ferror(file))
+    {
+        error = format("Failed to write to '{}'", path);
+        return false;
+    }
+    return true;
+}
+
+void Y4mWriter::ConvertRows(int32 firstRow, const uint8* rgba, int32 rowCount)
+{
+    uint8* yPlane = frame.data();
+    uint8* uPlane = yPlane + (size_t)width * height;
+    uint8* vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+    size_t rowBytes = (size_t)width * 4;
+    for (int32 j = 0; j < rowCount; j += 2)
+    {
+        // The last row of an odd height frame is paired with itself
+        const uint8* top = rgba + rowBytes * j;
+        const uint8* bottom = j + 1 < rowCount ? top + rowBytes : top;
+        int32 row = firstRow + j;
+        LumaRow(top, width, yPlane + (size_t)width * row);
+        if (j + 1 < rowCount)
+            LumaRow(bottom, width, yPlane + (size_t)width * (row + 1));
+        ChromaRow(top, bottom, width, uPlane + (size_t)chromaWidth * (row / 2), vPlane + (size_t)chromaWidth * (row / 2));
+    }
+}
+
+bool Y4mWriter::WriteFrame(string& error)
+{
+    // Flushed at every frame so the encoder reading the pipe never waits on a frame that is already done
+    static const char FrameHeader[] = "FRAME\n";
+    size += fwrite(FrameHeader, 1, sizeof(FrameHeader) - 1, file);
+    size += fwrite(frame.data(), 1, frame.size(), file);
+    fflush(file);
+    if (ferror(file))
+    {
+        error = format("Failed to write to '{}'", path);
+        return false;
+    }
+    return true;
+}
+
+bool Y4mWriter::Close(string& error)
+{
+    if (!file)
+        return true;
+
+    bool failed = ferror(file) != 0;
+    if (file == stdout)
+        failed = fflush(file) != 0 || failed;
+    else
+        failed = fclose(file) != 0 || failed;
+    file = nullptr;
+    if (failed)
+    {
+        error = format("Failed to write to '{}'", path);
+        return false;
+    }
+    return true;
+}
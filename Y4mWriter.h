@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+
+// Writes every frame of an animation into one YUV4MPEG2 stream of 4:2:0 video, to stdout, a named pipe or a file, so a
+// video encoder can read the frames straight from the renderer instead of from thousands of image files
+// Pixels are converted with the BT.601 limited range matrix video encoders assume for untagged video, over a black
+// background where they are transparent
+class Y4mWriter
+{
+public:
+    Y4mWriter() = default;
+    Y4mWriter(const Y4mWriter&) = delete;
+    Y4mWriter& operator=(const Y4mWriter&) = delete;
+    ~Y4mWriter();
+
+    // Writes the stream header, "-" writes to stdout
+    bool Open(const std::string& path, int32 width, int32 height, int32 frameRate, std::string& error);
+
+    // Converts rows of RGBA pixels into the frame being written, firstRow must be even as each row of chroma covers two
+    // rows of pixels, and rowCount too unless the band ends at the bottom of the frame
+    // Bands that don't overlap can be converted on every thread at once
+    void ConvertRows(int32 firstRow, const uint8* rgba, int32 rowCount);
+
+    // Writes the frame, once every row has been converted
+    bool WriteFrame(std::string& error);
+
+    bool Close(std::string& error);
+
+    // Bytes written to the stream so far
+    uint64 Size() const { return size; }
+
+private:
+    FILE* file = nullptr;
+    std::string path;
+    int32 width = 0;
+    int32 height = 0;
+    int32 chromaWidth = 0;
+    int32 chromaHeight = 0;
+    uint64 size = 0;
+    std::vector<uint8> frame;  // Y, then U, then V planes
+};
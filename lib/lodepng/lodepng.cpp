@@ -39,6 +39,25 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdlib.h> /* allocations */
 #endif /* LODEPNG_COMPILE_ALLOCATORS */
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LODEPNG_SSE2 /*filter the scanlines 16 bytes at a time, SSE2 is always there on x86-64*/
+#include <emmintrin.h>
+#endif /*SSE2*/
+
+/*carry-less multiplication for CRC32, compiled in where the compiler can target it per function,
+and only used if the CPU turns out to have it*/
+#if defined(LODEPNG_SSE2) && !defined(LODEPNG_NO_PCLMUL) && (defined(__GNUC__) || (defined(_MSC_VER) && !defined(__clang__)))
+#define LODEPNG_PCLMUL
+#include <wmmintrin.h>
+#ifdef __GNUC__
+#include <cpuid.h>
+#define LODEPNG_TARGET_PCLMUL __attribute__((target("pclmul")))
+#else /*__GNUC__*/
+#include <intrin.h>
+#define LODEPNG_TARGET_PCLMUL
+#endif /*__GNUC__*/
+#endif /*PCLMUL*/
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -1496,10 +1515,16 @@ typedef struct Hash {
   int* headz; /*similar to head, but for chainz*/
   unsigned short* chainz; /*those with same amount of zeros*/
   unsigned short* zeros; /*length of zeros streak, used as a second hash chain*/
+
+  /*only used by encodeLZ77Fast, null otherwise*/
+  size_t* fasthead; /*hash value to the last position with that hash, or FAST_NO_POS*/
+  size_t* fastprev; /*circular pos to the previous position with the same hash*/
 } Hash;
 
 static unsigned hash_init(Hash* hash, unsigned windowsize) {
   unsigned i;
+  hash->fasthead = 0;
+  hash->fastprev = 0;
   hash->head = (int*)lodepng_malloc(sizeof(int) * HASH_NUM_VALUES);
   hash->val = (int*)lodepng_malloc(sizeof(int) * windowsize);
   hash->chain = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
@@ -1531,6 +1556,9 @@ static void hash_cleanup(Hash* hash) {
   lodepng_free(hash->zeros);
   lodepng_free(hash->headz);
   lodepng_free(hash->chainz);
+
+  lodepng_free(hash->fasthead);
+  lodepng_free(hash->fastprev);
 }
 
 
@@ -1733,9 +1761,169 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
   return error;
 }
 
+/*
+Faster LZ77 encoder, selected with the fast_lz77 setting. Compared to encodeLZ77 it hashes
+the 4 bytes at a position in one go with a multiplicative hash, keeps absolute positions in its
+chains so it never needs to look at the hash value again, compares candidate matches 16 bytes at
+a time, and tries at most max_chain_length candidates per position, fewer once it has a good match.
+Hashing 4 bytes keeps the chains short on PNG data, at the cost of never finding matches of length 3.
+Runs of equal bytes or pixels, which dominate filtered fractal images, are found at the first
+candidates of the chain.
+*/
+#define FAST_HASH_BITS 15u
+#define FAST_NO_POS ((size_t)-1)
+#define FAST_GOOD_LENGTH 32u /*matches this long cut the rest of the search short, and are used without lazy matching*/
+
+static unsigned hash_init_fast(Hash* hash, unsigned windowsize) {
+  size_t i;
+  hash->fasthead = (size_t*)lodepng_malloc(sizeof(size_t) << FAST_HASH_BITS);
+  hash->fastprev = (size_t*)lodepng_malloc(sizeof(size_t) * windowsize);
+  if(!hash->fasthead || !hash->fastprev) return 83; /*alloc fail*/
+  for(i = 0; i != ((size_t)1 << FAST_HASH_BITS); ++i) hash->fasthead[i] = FAST_NO_POS;
+  for(i = 0; i != windowsize; ++i) hash->fastprev[i] = FAST_NO_POS;
+  return 0;
+}
+
+/*pos + 4 must be <= the size of the data*/
+static unsigned getHashFast(const unsigned char* data, size_t pos) {
+  unsigned value = (unsigned)data[pos] | ((unsigned)data[pos + 1] << 8u) | ((unsigned)data[pos + 2] << 16u) | ((unsigned)data[pos + 3] << 24u);
+  return (value * 2654435761u) >> (32u - FAST_HASH_BITS);
+}
+
+static void updateHashChainFast(Hash* hash, const unsigned char* data, size_t pos, unsigned windowsize) {
+  unsigned hashval = getHashFast(data, pos);
+  hash->fastprev[pos & (windowsize - 1)] = hash->fasthead[hashval];
+  hash->fasthead[hashval] = pos;
+}
+
+/*number of equal bytes at the start of a and b, up to maxlength*/
+static unsigned matchLength(const unsigned char* a, const unsigned char* b, unsigned maxlength) {
+  unsigned length = 0;
+#ifdef LODEPNG_SSE2
+  while(length + 16 <= maxlength) {
+    __m128i va = _mm_loadu_si128((const __m128i*)(a + length));
+    __m128i vb = _mm_loadu_si128((const __m128i*)(b + length));
+    unsigned differ = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffffu;
+    if(differ) {
+      while(!(differ & 1u)) { differ >>= 1u; ++length; }
+      return length;
+    }
+    length += 16;
+  }
+#endif /*LODEPNG_SSE2*/
+  while(length < maxlength && a[length] == b[length]) ++length;
+  return length;
+}
+
+/*finds the longest earlier match for the data at pos, which must not be in the hash chains yet*/
+static void findMatchFast(const Hash* hash, const unsigned char* in, size_t pos, size_t insize, unsigned windowsize,
+                          unsigned nicematch, unsigned maxchainlength, unsigned* length, unsigned* offset) {
+  size_t candidate = hash->fasthead[getHashFast(in, pos)];
+  unsigned maxlength = insize - pos < MAX_SUPPORTED_DEFLATE_LENGTH ? (unsigned)(insize - pos)
+                                                                    : MAX_SUPPORTED_DEFLATE_LENGTH;
+  unsigned chainlength = 0;
+  *length = 0;
+  *offset = 0;
+  if(nicematch > maxlength) nicematch = maxlength;
+
+  /*stops at the end of the chain, or at a slot that was reused for a newer position*/
+  while(candidate != FAST_NO_POS && candidate < pos && pos - candidate <= windowsize && chainlength++ < maxchainlength) {
+    /*a candidate can only be longer if it also matches at the current length*/
+    if(in[candidate + *length] == in[pos + *length]) {
+      unsigned current = matchLength(&in[candidate], &in[pos], maxlength);
+      if(current > *length) {
+        *length = current;
+        *offset = (unsigned)(pos - candidate);
+        if(current >= nicematch) break;
+        /*a longer match is unlikely to make much difference once this one is good, so look less hard*/
+        if(current >= FAST_GOOD_LENGTH) maxchainlength = chainlength + (maxchainlength - chainlength) / 4u;
+      }
+    }
+    {
+      size_t previous = hash->fastprev[candidate & (windowsize - 1)];
+      if(previous >= candidate) break;
+      candidate = previous;
+    }
+  }
+}
+
+static unsigned encodeLZ77Fast(uivector* out, Hash* hash,
+                               const unsigned char* in, size_t inpos, size_t insize, unsigned windowsize,
+                               unsigned minmatch, unsigned nicematch, unsigned lazymatching, unsigned maxchainlength) {
+  size_t pos = inpos, i;
+  unsigned length, offset;
+  unsigned pending = 0; /*whether the position before pos is still to be output, as a literal or as a match*/
+  unsigned pendinglength = 0, pendingoffset = 0;
+
+  if(windowsize == 0 || windowsize > 32768) return 60; /*error: windowsize smaller/larger than allowed*/
+  if((windowsize & (windowsize - 1)) != 0) return 90; /*error: must be power of two*/
+  if(nicematch > MAX_SUPPORTED_DEFLATE_LENGTH) nicematch = MAX_SUPPORTED_DEFLATE_LENGTH;
+  /*for large window lengths, assume the user wants no compression loss, same as encodeLZ77*/
+  if(maxchainlength == 0) maxchainlength = windowsize >= 8192 ? windowsize : windowsize / 8u;
+
+  while(pos < insize) {
+    length = 0;
+    offset = 0;
+    if(pos + 4 <= insize) {
+      findMatchFast(hash, in, pos, insize, windowsize, nicematch, maxchainlength, &length, &offset);
+      updateHashChainFast(hash, in, pos, windowsize);
+    }
+    /*compensate for the fact that longer offsets have more extra bits, a length of only 3 may be not worth it then*/
+    if(length < 3 || length < minmatch || (length == 3 && offset > 4096)) length = 0;
+
+    /*lazy matching: the pending match is only used if the match here isn't longer*/
+    if(pending && pendinglength && length <= pendinglength) {
+      addLengthDistance(out, pendinglength, pendingoffset);
+      /*pos - 1 and pos are in the hash chains already*/
+      for(i = pos + 1; i < pos - 1 + pendinglength; ++i) {
+        if(i + 4 <= insize) updateHashChainFast(hash, in, i, windowsize);
+      }
+      pos += pendinglength - 1;
+      pending = 0;
+      continue;
+    }
+    if(pending && !uivector_push_back(out, in[pos - 1])) return 83; /*alloc fail*/
+    pending = 0;
+
+    if(length && (!lazymatching || length >= FAST_GOOD_LENGTH || length >= nicematch)) {
+      addLengthDistance(out, length, offset);
+      for(i = pos + 1; i < pos + length; ++i) {
+        if(i + 4 <= insize) updateHashChainFast(hash, in, i, windowsize);
+      }
+      pos += length;
+    } else if(!lazymatching) {
+      if(!uivector_push_back(out, in[pos])) return 83; /*alloc fail*/
+      ++pos;
+    } else {
+      pending = 1;
+      pendinglength = length;
+      pendingoffset = offset;
+      ++pos;
+    }
+  }
+
+  /*the pending match can't go past the end since its length was limited to the data left*/
+  if(pending) {
+    if(pendinglength) addLengthDistance(out, pendinglength, pendingoffset);
+    else if(!uivector_push_back(out, in[pos - 1])) return 83; /*alloc fail*/
+  }
+  return 0;
+}
+
+/*runs the LZ77 encoder chosen by the settings*/
+static unsigned encodeLZ77Settings(uivector* out, Hash* hash, const unsigned char* in, size_t inpos, size_t insize,
+                                   const LodePNGCompressSettings* settings) {
+  if(settings->fast_lz77) {
+    return encodeLZ77Fast(out, hash, in, inpos, insize, settings->windowsize, settings->minmatch,
+                          settings->nicematch, settings->lazymatching, settings->max_chain_length);
+  }
+  return encodeLZ77(out, hash, in, inpos, insize, settings->windowsize,
+                    settings->minmatch, settings->nicematch, settings->lazymatching);
+}
+
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize) {
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize, unsigned final) {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
 
@@ -1746,7 +1934,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     unsigned char firstbyte;
     size_t pos = out->size;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = final && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     LEN = 65535;
@@ -1859,8 +2047,7 @@ static unsigned deflateDynamic(LodePNGBitWriter* writer, Hash* hash,
     lodepng_memset(frequencies_cl, 0, NUM_CODE_LENGTH_CODES * sizeof(*frequencies_cl));
 
     if(settings->use_lz77) {
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+      error = encodeLZ77Settings(&lz77_encoded, hash, data, datapos, dataend, settings);
       if(error) break;
     } else {
       if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
@@ -2045,8 +2232,7 @@ static unsigned deflateFixed(LodePNGBitWriter* writer, Hash* hash,
     if(settings->use_lz77) /*LZ77 encoded*/ {
       uivector lz77_encoded;
       uivector_init(&lz77_encoded);
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+      error = encodeLZ77Settings(&lz77_encoded, hash, data, datapos, dataend, settings);
       if(!error) writeLZ77data(writer, &lz77_encoded, &tree_ll, &tree_d);
       uivector_cleanup(&lz77_encoded);
     } else /*no LZ77, but still will be Huffman compressed*/ {
@@ -2065,47 +2251,95 @@ static unsigned deflateFixed(LodePNGBitWriter* writer, Hash* hash,
   return error;
 }
 
-static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings) {
+/*adds the positions in[start..end) to the hash chains without encoding them, so later data can refer back to them*/
+static void hash_prime(Hash* hash, const unsigned char* in, size_t start, size_t end, size_t insize, unsigned windowsize) {
+  size_t pos;
+  unsigned numzeros = 0;
+  if(hash->fasthead) {
+    for(pos = start; pos < end && pos + 4 <= insize; ++pos) updateHashChainFast(hash, in, pos, windowsize);
+    return;
+  }
+  for(pos = start; pos < end; ++pos) {
+    unsigned hashval = getHash(in, insize, pos);
+    if(hashval == 0) {
+      if(numzeros == 0) numzeros = countZeros(in, insize, pos);
+      else if(pos + numzeros > insize || in[pos + numzeros - 1] != 0) --numzeros;
+    } else {
+      numzeros = 0;
+    }
+    updateHashChain(hash, pos & (windowsize - 1), hashval, (unsigned short)numzeros);
+  }
+}
+
+/*compresses in[inpos..insize), the bytes before inpos only serve as the dictionary*/
+static unsigned lodepng_deflatev_chunk(ucvector* out, const unsigned char* in, size_t inpos, size_t insize,
+                                       const LodePNGCompressSettings* settings, unsigned final) {
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
+  size_t datasize = insize - inpos;
   Hash hash;
   LodePNGBitWriter writer;
 
   LodePNGBitWriter_init(&writer, out);
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
-  else if(settings->btype == 1) blocksize = insize;
-  else /*if(settings->btype == 2)*/ {
-    /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
-    blocksize = insize / 8u + 8;
-    if(blocksize < 65536) blocksize = 65536;
-    if(blocksize > 262144) blocksize = 262144;
-  }
+  else if(settings->btype == 0) error = deflateNoCompression(out, in + inpos, datasize, final);
+  else {
+    if(settings->btype == 1) blocksize = datasize;
+    else /*if(settings->btype == 2)*/ {
+      /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
+      blocksize = datasize / 8u + 8;
+      if(blocksize < 65536) blocksize = 65536;
+      if(blocksize > 262144) blocksize = 262144;
+    }
 
-  numdeflateblocks = (insize + blocksize - 1) / blocksize;
-  if(numdeflateblocks == 0) numdeflateblocks = 1;
+    numdeflateblocks = (datasize + blocksize - 1) / blocksize;
+    if(numdeflateblocks == 0) numdeflateblocks = 1;
 
-  error = hash_init(&hash, settings->windowsize);
+    error = hash_init(&hash, settings->windowsize);
+    if(!error && settings->use_lz77 && settings->fast_lz77) error = hash_init_fast(&hash, settings->windowsize);
 
-  if(!error) {
-    for(i = 0; i != numdeflateblocks && !error; ++i) {
-      unsigned final = (i == numdeflateblocks - 1);
-      size_t start = i * blocksize;
-      size_t end = start + blocksize;
-      if(end > insize) end = insize;
-
-      if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, start, end, settings, final);
-      else if(settings->btype == 2) error = deflateDynamic(&writer, &hash, in, start, end, settings, final);
+    if(!error) {
+      if(settings->use_lz77) {
+        hash_prime(&hash, in, inpos > settings->windowsize ? inpos - settings->windowsize : 0, inpos, insize,
+                   settings->windowsize);
+      }
+      for(i = 0; i != numdeflateblocks && !error; ++i) {
+        unsigned lastblock = final && (i == numdeflateblocks - 1);
+        size_t start = inpos + i * blocksize;
+        size_t end = start + blocksize;
+        if(end > insize) end = insize;
+
+        if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, start, end, settings, lastblock);
+        else if(settings->btype == 2) error = deflateDynamic(&writer, &hash, in, start, end, settings, lastblock);
+      }
     }
+
+    hash_cleanup(&hash);
   }
 
-  hash_cleanup(&hash);
+  /*end with an empty stored block, which byte-aligns the output so another chunk can be appended to it*/
+  if(!error && !final) {
+    size_t pos;
+    if(settings->btype != 0) writeBits(&writer, 0, 3); /*BFINAL 0, BTYPE 00, the rest of the byte is padding*/
+    else if(!ucvector_resize(out, out->size + 1)) return 83; /*alloc fail*/
+    else out->data[out->size - 1] = 0;
+    pos = out->size;
+    if(!ucvector_resize(out, out->size + 4)) return 83; /*alloc fail*/
+    out->data[pos + 0] = 0; /*LEN 0*/
+    out->data[pos + 1] = 0;
+    out->data[pos + 2] = 255; /*NLEN 65535*/
+    out->data[pos + 3] = 255;
+  }
 
   return error;
 }
 
+static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
+                                 const LodePNGCompressSettings* settings) {
+  return lodepng_deflatev_chunk(out, in, 0, insize, settings, 1);
+}
+
 unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings) {
@@ -2116,6 +2350,16 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
   return error;
 }
 
+unsigned lodepng_deflate_chunk(unsigned char** out, size_t* outsize,
+                               const unsigned char* in, size_t inpos, size_t insize,
+                               const LodePNGCompressSettings* settings, unsigned final) {
+  ucvector v = ucvector_init(*out, *outsize);
+  unsigned error = lodepng_deflatev_chunk(&v, in, inpos, insize, settings, final);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
 static unsigned deflate(unsigned char** out, size_t* outsize,
                         const unsigned char* in, size_t insize,
                         const LodePNGCompressSettings* settings) {
@@ -2134,16 +2378,52 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 /* / Adler32                                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len) {
+#ifdef LODEPNG_SSE2
+static unsigned sum_epi32_sse2(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (unsigned)_mm_cvtsi128_si32(v);
+}
+
+/*Adds len bytes to the sums, len must be a multiple of 16 and small enough for the sums not to
+overflow. Over blocks of 16 bytes, s2 gains 16 times s1 from before each block, plus each byte
+weighted by its distance from the end of its block.*/
+static void update_adler32_sse2(unsigned* s1, unsigned* s2, const unsigned char* data, unsigned len) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i weights_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+  const __m128i weights_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+  __m128i sum1 = zero; /*sum of all bytes so far*/
+  __m128i prefix = zero; /*sum of sum1 at the start of each block*/
+  __m128i sum2 = zero; /*weighted sum of the bytes within their blocks*/
+  unsigned i;
+  for(i = 0; i != len; i += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)&data[i]);
+    prefix = _mm_add_epi32(prefix, sum1);
+    sum1 = _mm_add_epi32(sum1, _mm_sad_epu8(bytes, zero));
+    sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weights_lo));
+    sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weights_hi));
+  }
+  *s2 += len * *s1 + 16u * sum_epi32_sse2(prefix) + sum_epi32_sse2(sum2);
+  *s1 += sum_epi32_sse2(sum1);
+}
+#endif /*LODEPNG_SSE2*/
+
+static unsigned update_adler32(unsigned adler, const unsigned char* data, size_t len) {
   unsigned s1 = adler & 0xffffu;
   unsigned s2 = (adler >> 16u) & 0xffffu;
 
   while(len != 0u) {
-    unsigned i;
+    unsigned i = 0;
     /*at least 5552 sums can be done before the sums overflow, saving a lot of module divisions*/
-    unsigned amount = len > 5552u ? 5552u : len;
+    unsigned amount = len > 5552u ? 5552u : (unsigned)len;
     len -= amount;
-    for(i = 0; i != amount; ++i) {
+#ifdef LODEPNG_SSE2
+    /*whole blocks of 16 bytes at once, 5552 is a multiple of 16 so only the very end is left over*/
+    i = amount & ~15u;
+    update_adler32_sse2(&s1, &s2, data, i);
+    data += i;
+#endif /*LODEPNG_SSE2*/
+    for(; i != amount; ++i) {
       s1 += (*data++);
       s2 += s1;
     }
@@ -2155,10 +2435,16 @@ static unsigned update_adler32(unsigned adler, const unsigned char* data, unsign
 }
 
 /*Return the adler32 of the bytes data[0..len-1]*/
-static unsigned adler32(const unsigned char* data, unsigned len) {
+static unsigned adler32(const unsigned char* data, size_t len) {
   return update_adler32(1u, data, len);
 }
 
+#ifdef LODEPNG_COMPILE_ENCODER
+unsigned lodepng_update_adler32(unsigned adler, const unsigned char* data, size_t len) {
+  return update_adler32(adler, data, len);
+}
+#endif /*LODEPNG_COMPILE_ENCODER*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -2199,7 +2485,7 @@ static unsigned lodepng_zlib_decompressv(ucvector* out,
 
   if(!settings->ignore_adler32) {
     unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
-    unsigned checksum = adler32(out->data, (unsigned)(out->size));
+    unsigned checksum = adler32(out->data, out->size);
     if(checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
   }
 
@@ -2264,7 +2550,7 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   }
 
   if(!error) {
-    unsigned ADLER32 = adler32(in, (unsigned)insize);
+    unsigned ADLER32 = adler32(in, insize);
     /*zlib data: 1 byte CMF (CM+CINFO), 1 byte FLG, deflate data, 4 byte ADLER32 checksum of the Decompressed data*/
     unsigned CMF = 120; /*0b01111000: CM 8, CINFO 7. With CINFO 7, any window size up to 32768 can be used.*/
     unsigned FLEVEL = 0;
@@ -2332,13 +2618,15 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings) {
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->fast_lz77 = 0;
+  settings->max_chain_length = 0;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0, 0, 0};
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2654,10 +2942,8 @@ static const unsigned lodepng_crc32_table7[256] = {
   0x2c8e0fffu, 0xe0240f61u, 0x6eab0882u, 0xa201081cu, 0xa8c40105u, 0x646e019bu, 0xeae10678u, 0x264b06e6u
 };
 
-/* Computes the cyclic redundancy check as used by PNG chunks*/
-unsigned lodepng_crc32(const unsigned char* data, size_t length) {
-  /*Using the Slicing by Eight algorithm*/
-  unsigned r = 0xffffffffu;
+/*Updates the CRC register r, using the Slicing by Eight algorithm*/
+static unsigned crc32_update_table(unsigned r, const unsigned char* data, size_t length) {
   while(length >= 8) {
     r = lodepng_crc32_table7[(data[0] ^ (r & 0xffu))] ^
         lodepng_crc32_table6[(data[1] ^ ((r >> 8) & 0xffu))] ^
@@ -2673,7 +2959,106 @@ unsigned lodepng_crc32(const unsigned char* data, size_t length) {
   while(length--) {
     r = lodepng_crc32_table0[(r ^ *data++) & 0xffu] ^ (r >> 8);
   }
-  return r ^ 0xffffffffu;
+  return r;
+}
+
+#ifdef LODEPNG_PCLMUL
+static int lodepng_detect_pclmul(void) {
+#ifdef __GNUC__
+  unsigned eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && ((ecx >> 1) & 1u);
+#else /*__GNUC__*/
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] >> 1) & 1;
+#endif /*__GNUC__*/
+}
+
+static int lodepng_cpu_has_pclmul(void) {
+  /*looked up once, by the first thread to get here, as C++ initializes local statics exactly once while
+  any other thread that arrives meanwhile waits for it*/
+  static const int has_pclmul = lodepng_detect_pclmul();
+  return has_pclmul;
+}
+
+/*Updates the CRC register r by folding 64 bytes at a time with carry-less multiplications, then
+reducing the remainder with a Barrett reduction, as described in Intel's "Fast CRC Computation for
+Generic Polynomials Using PCLMULQDQ Instruction". length must be a multiple of 16 and at least 64.
+The constants are powers of x modulo the bit reflected PNG polynomial, split into 32-bit halves.*/
+LODEPNG_TARGET_PCLMUL
+static unsigned crc32_update_pclmul(unsigned r, const unsigned char* data, size_t length) {
+  const __m128i k1k2 = _mm_set_epi32(0x00000001, (int)0xc6e41596u, 0x00000001, 0x54442bd4);
+  const __m128i k3k4 = _mm_set_epi32(0x00000000, (int)0xccaa009eu, 0x00000001, 0x751997d0);
+  const __m128i k5 = _mm_set_epi32(0, 0, 0x00000001, 0x63cd6124);
+  const __m128i poly = _mm_set_epi32(0x00000001, (int)0xf7011641u, 0x00000001, (int)0xdb710641u);
+  const __m128i low32 = _mm_setr_epi32(-1, 0, -1, 0);
+  __m128i x1 = _mm_loadu_si128((const __m128i*)&data[0]);
+  __m128i x2 = _mm_loadu_si128((const __m128i*)&data[16]);
+  __m128i x3 = _mm_loadu_si128((const __m128i*)&data[32]);
+  __m128i x4 = _mm_loadu_si128((const __m128i*)&data[48]);
+  __m128i t;
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)r));
+  data += 64;
+  length -= 64;
+
+  /*four independent folds keep the multiplier busy*/
+  while(length >= 64) {
+    __m128i t1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    __m128i t2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    __m128i t3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    __m128i t4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), t1);
+    x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), t2);
+    x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), t3);
+    x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), t4);
+    x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)&data[0]));
+    x2 = _mm_xor_si128(x2, _mm_loadu_si128((const __m128i*)&data[16]));
+    x3 = _mm_xor_si128(x3, _mm_loadu_si128((const __m128i*)&data[32]));
+    x4 = _mm_xor_si128(x4, _mm_loadu_si128((const __m128i*)&data[48]));
+    data += 64;
+    length -= 64;
+  }
+
+  /*fold the four into one, then fold in what is left 16 bytes at a time*/
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), t), x2);
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), t), x3);
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), t), x4);
+  while(length >= 16) {
+    t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), t), _mm_loadu_si128((const __m128i*)data));
+    data += 16;
+    length -= 16;
+  }
+
+  /*128 bits to 64*/
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+  t = _mm_srli_si128(x1, 4);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00), t);
+
+  /*Barrett reduction to 32 bits*/
+  t = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+  t = _mm_clmulepi64_si128(_mm_and_si128(t, low32), poly, 0x00);
+  x1 = _mm_xor_si128(x1, t);
+  return (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif /*LODEPNG_PCLMUL*/
+
+/* Computes the cyclic redundancy check as used by PNG chunks*/
+unsigned lodepng_crc32(const unsigned char* data, size_t length) {
+  unsigned r = 0xffffffffu;
+#ifdef LODEPNG_PCLMUL
+  if(length >= 64 && lodepng_cpu_has_pclmul()) {
+    size_t folded = length & ~(size_t)15u;
+    r = crc32_update_pclmul(r, data, folded);
+    data += folded;
+    length -= folded;
+  }
+#endif /*LODEPNG_PCLMUL*/
+  return crc32_update_table(r, data, length) ^ 0xffffffffu;
 }
 #else /* LODEPNG_COMPILE_CRC */
 /*in this case, the function is only declared here, and must be defined externally
@@ -4235,6 +4620,11 @@ static unsigned auto_choose_color(LodePNGColorMode* mode_out,
   return error;
 }
 
+unsigned lodepng_auto_choose_color(LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
+                                   const LodePNGColorStats* stats) {
+  return auto_choose_color(mode_out, mode_in, stats);
+}
+
 #endif /* #ifdef LODEPNG_COMPILE_ENCODER */
 
 /*Paeth predictor, used by PNG filter type 4*/
@@ -5827,28 +6217,80 @@ static unsigned addChunk_sBIT(ucvector* out, const LodePNGInfo* info) {
 
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
+#ifdef LODEPNG_SSE2
+/*v1 if the mask is set, v0 otherwise*/
+static __m128i select_sse2(__m128i mask, __m128i v1, __m128i v0) {
+  return _mm_or_si128(_mm_and_si128(mask, v1), _mm_andnot_si128(mask, v0));
+}
+
+/*paethPredictor on 8 values widened to 16 bits*/
+static __m128i paethPredictor_sse2(__m128i a, __m128i b, __m128i c) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i pa = _mm_sub_epi16(b, c);
+  __m128i pb = _mm_sub_epi16(a, c);
+  __m128i pc = _mm_add_epi16(pa, pb);
+  __m128i mask;
+  pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa)); /*abs, SSE2 has no _mm_abs_epi16*/
+  pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+  pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+  /*same priorities as paethPredictor*/
+  mask = _mm_cmplt_epi16(pb, pa);
+  a = select_sse2(mask, b, a);
+  pa = _mm_min_epi16(pa, pb);
+  return select_sse2(_mm_cmplt_epi16(pc, pa), c, a);
+}
+#endif /*LODEPNG_SSE2*/
+
 static void filterScanline(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
                            size_t length, size_t bytewidth, unsigned char filterType) {
-  size_t i;
+  size_t i = 0;
+#ifdef LODEPNG_SSE2
+  /*filtering only reads unfiltered bytes, so every byte of a scanline can be filtered independently*/
+  __m128i zero = _mm_setzero_si128();
+#endif /*LODEPNG_SSE2*/
   switch(filterType) {
     case 0: /*None*/
-      for(i = 0; i != length; ++i) out[i] = scanline[i];
+      lodepng_memcpy(out, scanline, length);
       break;
     case 1: /*Sub*/
       for(i = 0; i != bytewidth; ++i) out[i] = scanline[i];
-      for(i = bytewidth; i < length; ++i) out[i] = scanline[i] - scanline[i - bytewidth];
+#ifdef LODEPNG_SSE2
+      for(; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+        __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+        _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(x, a));
+      }
+#endif /*LODEPNG_SSE2*/
+      for(; i < length; ++i) out[i] = scanline[i] - scanline[i - bytewidth];
       break;
     case 2: /*Up*/
       if(prevline) {
-        for(i = 0; i != length; ++i) out[i] = scanline[i] - prevline[i];
+#ifdef LODEPNG_SSE2
+        for(; i + 16 <= length; i += 16) {
+          __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+          __m128i b = _mm_loadu_si128((const __m128i*)&prevline[i]);
+          _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(x, b));
+        }
+#endif /*LODEPNG_SSE2*/
+        for(; i != length; ++i) out[i] = scanline[i] - prevline[i];
       } else {
-        for(i = 0; i != length; ++i) out[i] = scanline[i];
+        lodepng_memcpy(out, scanline, length);
       }
       break;
     case 3: /*Average*/
       if(prevline) {
         for(i = 0; i != bytewidth; ++i) out[i] = scanline[i] - (prevline[i] >> 1);
-        for(i = bytewidth; i < length; ++i) out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) >> 1);
+#ifdef LODEPNG_SSE2
+        for(; i + 16 <= length; i += 16) {
+          __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+          __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+          __m128i b = _mm_loadu_si128((const __m128i*)&prevline[i]);
+          /*_mm_avg_epu8 rounds up, take the rounding back off to get (a + b) >> 1*/
+          __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+          _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(x, average));
+        }
+#endif /*LODEPNG_SSE2*/
+        for(; i < length; ++i) out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) >> 1);
       } else {
         for(i = 0; i != bytewidth; ++i) out[i] = scanline[i];
         for(i = bytewidth; i < length; ++i) out[i] = scanline[i] - (scanline[i - bytewidth] >> 1);
@@ -5858,19 +6300,72 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       if(prevline) {
         /*paethPredictor(0, prevline[i], 0) is always prevline[i]*/
         for(i = 0; i != bytewidth; ++i) out[i] = (scanline[i] - prevline[i]);
-        for(i = bytewidth; i < length; ++i) {
+#ifdef LODEPNG_SSE2
+        for(; i + 16 <= length; i += 16) {
+          __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+          __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+          __m128i b = _mm_loadu_si128((const __m128i*)&prevline[i]);
+          __m128i c = _mm_loadu_si128((const __m128i*)&prevline[i - bytewidth]);
+          __m128i low = paethPredictor_sse2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                            _mm_unpacklo_epi8(c, zero));
+          __m128i high = paethPredictor_sse2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                             _mm_unpackhi_epi8(c, zero));
+          _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(x, _mm_packus_epi16(low, high)));
+        }
+#endif /*LODEPNG_SSE2*/
+        for(; i < length; ++i) {
           out[i] = (scanline[i] - paethPredictor(scanline[i - bytewidth], prevline[i], prevline[i - bytewidth]));
         }
       } else {
         for(i = 0; i != bytewidth; ++i) out[i] = scanline[i];
         /*paethPredictor(scanline[i - bytewidth], 0, 0) is always scanline[i - bytewidth]*/
-        for(i = bytewidth; i < length; ++i) out[i] = (scanline[i] - scanline[i - bytewidth]);
+#ifdef LODEPNG_SSE2
+        for(; i + 16 <= length; i += 16) {
+          __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+          __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+          _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(x, a));
+        }
+#endif /*LODEPNG_SSE2*/
+        for(; i < length; ++i) out[i] = (scanline[i] - scanline[i - bytewidth]);
       }
       break;
     default: return; /*invalid filter type given*/
   }
 }
 
+/*sum of a filtered scanline for the minimum sum heuristic.
+For differences, each byte should be treated as signed, values above 127 are negative
+(converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
+This means filtertype 0 is almost never chosen, but that is justified.*/
+static size_t filterSum(const unsigned char* line, size_t length, unsigned char filterType) {
+  size_t x = 0, sum = 0;
+#ifdef LODEPNG_SSE2
+  __m128i zero = _mm_setzero_si128();
+  __m128i sums = zero;
+  for(; x + 16 <= length; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)&line[x]);
+    /*255 - s is ~s, so flipping the negative bytes gives their magnitude*/
+    if(filterType != 0) v = _mm_xor_si128(v, _mm_cmplt_epi8(v, zero));
+    sums = _mm_add_epi64(sums, _mm_sad_epu8(v, zero));
+  }
+  {
+    /*the sum of a scanline fits in the low 32 bits of both 64-bit halves*/
+    unsigned parts[4];
+    _mm_storeu_si128((__m128i*)parts, sums);
+    sum = (size_t)parts[0] + parts[2];
+  }
+#endif /*LODEPNG_SSE2*/
+  if(filterType == 0) {
+    for(; x != length; ++x) sum += line[x];
+  } else {
+    for(; x != length; ++x) {
+      unsigned char s = line[x];
+      sum += s < 128 ? s : (255U - s);
+    }
+  }
+  return sum;
+}
+
 /* integer binary logarithm, max return value is 31 */
 static size_t ilog2(size_t i) {
   size_t result = 0;
@@ -5892,8 +6387,8 @@ static size_t ilog2i(size_t i) {
   return i * l + ((i - (((size_t)1) << l)) << 1u);
 }
 
-static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
-                       const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
+unsigned lodepng_filter_rows(unsigned char* out, const unsigned char* in, unsigned w, unsigned y0, unsigned y1,
+                             const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
   /*
   For PNG filter method 0
   out must be a buffer with as size: h + (w * h * bpp + 7u) / 8u, because there are
@@ -5929,9 +6424,12 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
   if(bpp == 0) return 31; /*error: invalid color type*/
 
+  /*filtering only depends on the unfiltered previous scanline, so any range of rows can be filtered on its own*/
+  if(y0 > 0) prevline = &in[(size_t)(y0 - 1) * linebytes];
+
   if(strategy >= LFS_ZERO && strategy <= LFS_FOUR) {
     unsigned char type = (unsigned char)strategy;
-    for(y = 0; y != h; ++y) {
+    for(y = y0; y != y1; ++y) {
       size_t outindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
       size_t inindex = linebytes * y;
       out[outindex] = type; /*filter type byte*/
@@ -5950,24 +6448,14 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     }
 
     if(!error) {
-      for(y = 0; y != h; ++y) {
+      for(y = y0; y != y1; ++y) {
         /*try the 5 filter types*/
         for(type = 0; type != 5; ++type) {
-          size_t sum = 0;
+          size_t sum;
           filterScanline(attempt[type], &in[y * linebytes], prevline, linebytes, bytewidth, type);
 
           /*calculate the sum of the result*/
-          if(type == 0) {
-            for(x = 0; x != linebytes; ++x) sum += (unsigned char)(attempt[type][x]);
-          } else {
-            for(x = 0; x != linebytes; ++x) {
-              /*For differences, each byte should be treated as signed, values above 127 are negative
-              (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
-              This means filtertype 0 is almost never chosen, but that is justified.*/
-              unsigned char s = attempt[type][x];
-              sum += s < 128 ? s : (255U - s);
-            }
-          }
+          sum = filterSum(attempt[type], linebytes, type);
 
           /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
           if(type == 0 || sum < smallest) {
@@ -5980,7 +6468,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
         /*now fill the out values*/
         out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-        for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
+        lodepng_memcpy(&out[y * (linebytes + 1) + 1], attempt[bestType], linebytes);
       }
     }
 
@@ -5997,7 +6485,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     }
 
     if(!error) {
-      for(y = 0; y != h; ++y) {
+      for(y = y0; y != y1; ++y) {
         /*try the 5 filter types*/
         for(type = 0; type != 5; ++type) {
           size_t sum = 0;
@@ -6025,7 +6513,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
     for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
   } else if(strategy == LFS_PREDEFINED) {
-    for(y = 0; y != h; ++y) {
+    for(y = y0; y != y1; ++y) {
       size_t outindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
       size_t inindex = linebytes * y;
       unsigned char type = settings->predefined_filters[y];
@@ -6058,7 +6546,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       if(!attempt[type]) error = 83; /*alloc fail*/
     }
     if(!error) {
-      for(y = 0; y != h; ++y) /*try the 5 filter types*/ {
+      for(y = y0; y != y1; ++y) /*try the 5 filter types*/ {
         for(type = 0; type != 5; ++type) {
           unsigned testsize = (unsigned)linebytes;
           /*if(testsize > 8) testsize /= 8;*/ /*it already works good enough by testing a part of the row*/
@@ -6086,6 +6574,12 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   return error;
 }
 
+static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
+                       const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
+  if(settings->custom_filter) return settings->custom_filter(out, in, w, h, color, settings);
+  return lodepng_filter_rows(out, in, w, 0, h, color, settings);
+}
+
 static void addPaddingBits(unsigned char* out, const unsigned char* in,
                            size_t olinebits, size_t ilinebits, unsigned h) {
   /*The opposite of the removePaddingBits function
@@ -6647,6 +7141,7 @@ void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings) {
   settings->auto_convert = 1;
   settings->force_palette = 0;
   settings->predefined_filters = 0;
+  settings->custom_filter = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->add_id = 0;
   settings->text_compression = 1;
@@ -356,6 +356,11 @@ struct LodePNGCompressSettings /*deflate = compress*/ {
   unsigned minmatch; /*minimum lz77 length. 3 is normally best, 6 can be better for some PNGs. Default: 0*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
+  /*use the faster LZ77 match finder, which hashes and compares several bytes at once. Default: false*/
+  unsigned fast_lz77;
+  /*with fast_lz77, the most earlier positions tried per position. Lower is faster but compresses less.
+  Default: 0, which tries as many as the default match finder*/
+  unsigned max_chain_length;
 
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -814,6 +819,13 @@ unsigned lodepng_compute_color_stats(LodePNGColorStats* stats,
                                      const unsigned char* image, unsigned w, unsigned h,
                                      const LodePNGColorMode* mode_in);
 
+/*Chooses the color mode auto_convert would encode an image with these stats in. mode_out must already have been
+inited. Lets stats known some other way, e.g. from the colors an image is known to be made of with numpixels set to
+its size, stand in for scanning the image: encode with auto_convert off and this mode in info_png.color.
+Returns error code (e.g. alloc fail) or 0 if ok.*/
+unsigned lodepng_auto_choose_color(LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
+                                   const LodePNGColorStats* stats);
+
 /*Settings for the encoder.*/
 typedef struct LodePNGEncoderSettings {
   LodePNGCompressSettings zlibsettings; /*settings for the zlib encoder, such as window size, ...*/
@@ -841,6 +853,12 @@ typedef struct LodePNGEncoderSettings {
   NOTE: enabling this may worsen compression if auto_convert is used to choose
   optimal color mode, because it cannot use grayscale color modes in this case*/
   unsigned force_palette;
+
+  /*use custom function to filter the scanlines instead of the built in one (default: null), for
+  example to filter bands of rows on several threads with lodepng_filter_rows. out and in are as
+  described at lodepng_filter_rows, the image is w * h pixels*/
+  unsigned (*custom_filter)(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
+                            const LodePNGColorMode* color, const struct LodePNGEncoderSettings* settings);
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   /*add LodePNG identifier and version as a text chunk, for debugging*/
   unsigned add_id;
@@ -850,6 +868,17 @@ typedef struct LodePNGEncoderSettings {
 } LodePNGEncoderSettings;
 
 void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings);
+
+/*
+Filters the scanlines y0 to y1 (exclusive) of an image w pixels wide with the filter strategy
+of the settings, for use in a custom_filter. in holds the unfiltered scanlines of the whole
+image, each padded to a whole number of bytes. out receives the filtered scanlines at their
+place in the filtered image, where each scanline is preceded by its filter type byte.
+Every scanline only depends on the unfiltered scanline above it, so ranges of rows can be
+filtered independently and at the same time.
+*/
+unsigned lodepng_filter_rows(unsigned char* out, const unsigned char* in, unsigned w, unsigned y0, unsigned y1,
+                             const LodePNGColorMode* color, const LodePNGEncoderSettings* settings);
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 
@@ -1058,6 +1087,25 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings);
 
+/*
+Compress in[inpos..insize) with deflate as one piece of a larger deflate stream, for
+compressing the pieces of a buffer in parallel. The bytes before inpos are not
+output, they only prime the LZ77 dictionary (the last windowsize of them are used).
+Unless final is set, the last block is not marked final and the output ends with
+an empty stored block, which byte-aligns it so the output of the next piece can be
+appended to it directly. The piece with final set must come last.
+Out buffer must be freed after use.
+*/
+unsigned lodepng_deflate_chunk(unsigned char** out, size_t* outsize,
+                               const unsigned char* in, size_t inpos, size_t insize,
+                               const LodePNGCompressSettings* settings, unsigned final);
+
+/*
+Updates the Adler-32 checksum of zlib data with len more bytes, starting from 1, for
+writing the zlib trailer of a stream compressed in pieces with lodepng_deflate_chunk.
+*/
+unsigned lodepng_update_adler32(unsigned adler, const unsigned char* data, size_t len);
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_ZLIB*/
 